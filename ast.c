@@ -5,15 +5,74 @@
 #include "type.h" /* for primtype */
 #include "ast.h"
 #include "token.h"
+#include "sym.h"
+
+/*
+   node index : for each node_type, the list of the nodes of that kind
+   in creation order, and for nCALL, nVREF and nFUNCDECL a second index
+   keyed by name.  a node is in one list and has at most one name entry:
+   changing its kind (set_kind) takes it out of both first.  a list
+   keeps a hole where a node left it until half of it is holes.
+ */
+#define NKIND (nEND-nPROG)
+
+typedef struct kindlist {
+    AST *v;		/* 0 where a node left */
+    int cnt;
+    int max;
+    int dead;		/* holes in v */
+} kindlist;
+
+typedef struct nameentry {
+    char *name;
+    int  kind;
+    AST  a;		/* 0 once dropped */
+    int  next;
+} nameentry;
+
+/* the nodes of one context and what is kept about them, see context.c */
+struct AST_state {
+    Node *ast_buf;
+    int   ast_cnt;
+    int   ast_max;
+
+    kindlist   kinds[NKIND];	/* node index */
+    nameentry *names;
+    int        names_cnt;
+    int        names_max;
+    int       *name_bucket;
+    int        name_nbucket;
+
+    bool    deferred;		/* see defer_checks() */
+
+    Frozen *frozen;		/* see freeze_AST() */
+    int     frozen_cnt;
+    int     frozen_max;
+};
+
+static AST_state main_state;
+static __thread AST_state *st = &main_state;
 
-static Node *ast_buf;
-static int   ast_cnt;
+AST_state *new_AST_state()      { return (AST_state *)calloc(1, sizeof(AST_state)); }
+void use_AST(AST_state *s)      { st = (s) ? s : &main_state; }
+AST_state *cur_AST()            { return st; }
+
+void free_AST(AST_state *s) {
+    int i;
+    for (i=0;i<NKIND;i++) free(s->kinds[i].v);
+    free(s->ast_buf);
+    free(s->names);
+    free(s->name_bucket);
+    free(s->frozen);
+    if (s != &main_state) free(s);
+}
 
 static int xml = 1;
 static int eliminate_null_list = 1;
 
 static void print_Node_begin(Node*);
 static void print_Node_end(Node*);
+static void init_index(void);
 
 static char *namestr[] = {
     "prog",
@@ -28,6 +87,7 @@ static char *namestr[] = {
     "op0", "op1", "op2", "deref", "lval", 
     "call", "return", "break", "continue", 
     "@vars", "var", "con", "name",
+    "conv",
     0
 } ;
 
@@ -49,9 +109,11 @@ static char *nameof(int n) {
 
 void init_AST() {
     int sz = (MAX_AST_NODE+1) * sizeof(Node);
-    ast_buf = (Node *)malloc(sz);
-    bzero(ast_buf, sz);
-    ast_cnt = 0;
+    st->ast_max = MAX_AST_NODE;
+    st->ast_buf = (Node *)malloc(sz);
+    bzero(st->ast_buf, sz);
+    st->ast_cnt = 0;
+    init_index();
 
     make_AST_prim("int");
     make_AST_prim("char");
@@ -60,27 +122,359 @@ void init_AST() {
     make_AST_void("void");
 }
 
+static void init_index() {
+    int i;
+    for (i=0;i<NKIND;i++) st->kinds[i].cnt = st->kinds[i].dead = 0;
+    st->names_cnt = 0;
+    if (st->name_bucket == 0) {
+	st->name_nbucket = 256;
+	st->name_bucket = (int *)malloc(st->name_nbucket * sizeof(int));
+    }
+    for (i=0;i<st->name_nbucket;i++) st->name_bucket[i] = -1;
+}
+
+static unsigned hash_name(int kind, char *s) {
+    unsigned h = 2166136261u ^ kind;
+    while (*s) { h ^= (unsigned char)*s++; h *= 16777619u; }
+    return h;
+}
+
+static void index_kind(AST a, int kind) {
+    kindlist *kp;
+
+    st->ast_buf[a].kpos = 0;
+    if (kind < nPROG || kind >= nEND) return;
+    kp = &st->kinds[kind-nPROG];
+    if (kp->cnt >= kp->max) {
+	kp->max = (kp->max) ? kp->max * 2 : 64;
+	kp->v = (AST *)realloc(kp->v, kp->max * sizeof(AST));
+    }
+    kp->v[kp->cnt++] = a;
+    st->ast_buf[a].kpos = kp->cnt;
+}
+
+/* close the holes of a list, the nodes keep their order */
+static void pack_kind(kindlist *kp) {
+    int j, k;
+
+    for (j=k=0;j<kp->cnt;j++) {
+	if (kp->v[j] == 0) continue;
+	kp->v[k++] = kp->v[j];
+	st->ast_buf[kp->v[j]].kpos = k;
+    }
+    kp->cnt = k;
+    kp->dead = 0;
+}
+
+/* take a out of the list of its kind */
+static void unindex_kind(AST a) {
+    Node *np = &st->ast_buf[a];
+    kindlist *kp;
+
+    if (np->kpos == 0) return;
+    kp = &st->kinds[np->type-nPROG];
+    kp->v[np->kpos-1] = 0;
+    np->kpos = 0;
+    if (++kp->dead * 2 > kp->cnt) pack_kind(kp);
+}
+
+static void bucket_names() {
+    int i, n = st->name_nbucket;
+    for (i=0;i<n;i++) st->name_bucket[i] = -1;
+    for (i=0;i<st->names_cnt;i++) {
+	nameentry *ep = &st->names[i];
+	int b;
+	if (ep->a == 0) continue;
+	b = hash_name(ep->kind, ep->name) % n;
+	ep->next = st->name_bucket[b];
+	st->name_bucket[b] = i;
+    }
+}
+
+/* drop the name entry of a */
+static void unindex_name(AST a) {
+    Node *np = &st->ast_buf[a];
+    nameentry *ep;
+    int *e;
+
+    if (np->nent == 0) return;
+    ep = &st->names[np->nent-1];
+    e = &st->name_bucket[hash_name(ep->kind, ep->name) % st->name_nbucket];
+    while (*e != np->nent-1) e = &st->names[*e].next;
+    *e = ep->next;
+    ep->a = 0;
+    np->nent = 0;
+}
+
+static void rehash_names() {
+    int n = st->name_nbucket * 2;
+    st->name_bucket = (int *)realloc(st->name_bucket, n * sizeof(int));
+    st->name_nbucket = n;
+    bucket_names();
+}
+
+static void index_name(AST a, int kind, char *name) {
+    nameentry *ep;
+    int b;
+
+    unindex_name(a);
+    if (name == 0 || *name == 0) return;
+    if (st->names_cnt >= st->names_max) {
+	st->names_max = (st->names_max) ? st->names_max * 2 : 256;
+	st->names = (nameentry *)realloc(st->names, st->names_max * sizeof(nameentry));
+    }
+    if (st->names_cnt >= st->name_nbucket * 2) rehash_names();
+
+    b = hash_name(kind, name) % st->name_nbucket;
+    ep = &st->names[st->names_cnt];
+    ep->name = name;
+    ep->kind = kind;
+    ep->a    = a;
+    ep->next = st->name_bucket[b];
+    st->name_bucket[b] = st->names_cnt++;
+    st->ast_buf[a].nent = st->names_cnt;
+}
+
+/* name under which a node is indexed */
+static char *name_of_node(AST a) {
+    Node *np = &st->ast_buf[a];
+    switch (np->type) {
+	case nVREF:     return np->text;
+	case nCALL:     return get_text(np->son[1]);
+	case nFUNCDECL: return get_text(np->son[0]);
+	default:        return 0;
+    }
+}
+
+static void set_kind(AST a, int kind) {
+    Node *np = &st->ast_buf[a];
+    if (np->type == kind) return;
+    unindex_kind(a);
+    unindex_name(a);
+    np->type = kind;
+    index_kind(a, kind);
+}
+
+/* all nodes of the kind, in creation order; returns the count */
+int select_AST(int kind, AST *out, int max) {
+    kindlist *kp;
+    int i, n = 0;
+
+    if (kind < nPROG || kind >= nEND) return 0;
+    kp = &st->kinds[kind-nPROG];
+    for (i=0;i<kp->cnt;i++) {
+	AST a = kp->v[i];
+	if (a == 0) continue;
+	if (out && n < max) out[n] = a;
+	n++;
+    }
+    return n;
+}
+
+/* nCALL, nVREF or nFUNCDECL nodes with the name, latest first */
+int select_AST_name(int kind, char *name, AST *out, int max) {
+    int e, n = 0;
+
+    if (st->name_nbucket == 0) return 0;
+    for (e = st->name_bucket[hash_name(kind, name) % st->name_nbucket]; e >= 0; e = st->names[e].next) {
+	nameentry *ep = &st->names[e];
+	if (ep->kind != kind || strcmp(ep->name, name) != 0) continue;
+	if (out && n < max) out[n] = ep->a;
+	n++;
+    }
+    return n;
+}
+
+/* the node index against ast_buf : prints what is wrong, returns how many */
+int check_index_AST(FILE *fp) {
+    AST *v = (AST *)malloc((st->ast_cnt+1) * sizeof(AST));
+    int i, j, k, n, c, bad = 0;
+    char *name;
+
+    for (k=nPROG;k<nEND;k++) {
+	n = select_AST(k, v, st->ast_cnt+1);
+	for (i=1,j=0;i<=st->ast_cnt;i++) {
+	    if (st->ast_buf[i].type != k) continue;
+	    if (j >= n || v[j] != i) {
+		fprintf(fp, "INDEX: node %d of kind %s not selected in order\n", i, nameof(k));
+		bad++;
+		break;
+	    }
+	    j++;
+	}
+	if (i > st->ast_cnt && j != n) {
+	    fprintf(fp, "INDEX: %d nodes of kind %s, %d selected\n", j, nameof(k), n);
+	    bad++;
+	}
+    }
+    for (i=1;i<=st->ast_cnt;i++) {
+	k = st->ast_buf[i].type;
+	if (k != nVREF && k != nCALL && k != nFUNCDECL) continue;
+	if ((name = name_of_node(i)) == 0 || *name == 0) continue;
+	n = select_AST_name(k, name, v, st->ast_cnt+1);
+	for (j=c=0;j<n;j++) {
+	    if (v[j] == i) c++;
+	    if (st->ast_buf[v[j]].type != k || strcmp(name_of_node(v[j]), name) != 0) {
+		fprintf(fp, "INDEX: node %d selected as %s %s\n", v[j], nameof(k), name);
+		bad++;
+	    }
+	}
+	if (c != 1) {
+	    fprintf(fp, "INDEX: %s %s (node %d) selected %d times\n", nameof(k), name, i, c);
+	    bad++;
+	}
+    }
+    free(v);
+    return bad;
+}
+
+/* make room for node n of ast_buf */
+static void grow_AST(int n) {
+    int m = st->ast_max;
+    if (n <= st->ast_max) return;
+    while (n > m) m *= 2;
+    st->ast_buf = (Node *)realloc(st->ast_buf, (m+1) * sizeof(Node));
+    bzero(st->ast_buf + st->ast_max + 1, (m - st->ast_max) * sizeof(Node));
+    st->ast_max = m;
+}
+
 AST new_AST() {
-    if (ast_cnt < MAX_AST_NODE-1)
-	return ++ast_cnt;
-    return 0;
+    Node *np;
+    grow_AST(st->ast_cnt+1);
+    np = &st->ast_buf[++st->ast_cnt];
+    np->line = getlineno();
+    np->col = getlinepos();
+    return st->ast_cnt;
+}
+
+int count_AST() { return st->ast_cnt; }
+
+/* index nodes lo..hi as they are now */
+static void index_nodes(AST lo, AST hi) {
+    Node *np;
+    int i;
+    for (i=lo;i<=hi;i++) index_kind(i, st->ast_buf[i].type);
+    for (i=lo;i<=hi;i++) {
+	np = &st->ast_buf[i];
+	np->nent = 0;		/* another index's, if copied */
+	if (np->type == nVREF || np->type == nCALL || np->type == nFUNCDECL)
+	    index_name(i, np->type, name_of_node(i));
+    }
+}
+
+/*
+   node segments : a context may start from a copy of the nodes of
+   another (fork_AST), add its own after them, and have them appended
+   back (splice_AST).  the shared nodes keep their numbers, the others
+   move by the same distance.
+ */
+void fork_AST(AST_state *from) {
+    grow_AST(from->ast_cnt);
+    memcpy(st->ast_buf, from->ast_buf, (from->ast_cnt+1) * sizeof(Node));
+    st->ast_cnt = from->ast_cnt;
+    st->deferred = from->deferred;
+    init_index();
+    index_nodes(1, st->ast_cnt);
+}
+
+/* append the nodes of from after base; returns how far they moved */
+int splice_AST(AST_state *from, AST base) {
+    int d = st->ast_cnt - base;
+    int n = from->ast_cnt - base;
+    Node *np;
+    int i, k;
+
+    if (n <= 0) return d;
+    grow_AST(st->ast_cnt + n);
+    memcpy(st->ast_buf + st->ast_cnt + 1, from->ast_buf + base + 1, n * sizeof(Node));
+    for (i=st->ast_cnt+1;i<=st->ast_cnt+n;i++) {
+	np = &st->ast_buf[i];
+	if (np->father > base) np->father += d;
+	if (np->etype > base)  np->etype += d;
+	for (k=0;k<4;k++)
+	    if (np->son[k] > base) np->son[k] += d;
+    }
+    index_nodes(st->ast_cnt+1, st->ast_cnt+n);
+    st->ast_cnt += n;
+    return d;
+}
+
+/* the nodes made at lines past no are moved down by d lines */
+void move_lines_AST(int no, int d) {
+    int i;
+    for (i=1;i<=st->ast_cnt;i++)
+	if (st->ast_buf[i].line > no) st->ast_buf[i].line += d;
+}
+
+/* forget the nodes made after n */
+void rollback_AST(AST n) {
+    kindlist *kp;
+    int i, j, k;
+
+    if (n >= st->ast_cnt) return;
+    for (i=0;i<NKIND;i++) {
+	kp = &st->kinds[i];
+	for (j=0;j<kp->cnt;j++)
+	    if (kp->v[j] > n) kp->v[j] = 0;
+	pack_kind(kp);
+    }
+    for (j=k=0;j<st->names_cnt;j++) {
+	if (st->names[j].a == 0 || st->names[j].a > n) continue;
+	st->names[k] = st->names[j];
+	st->ast_buf[st->names[k].a].nent = k+1;
+	k++;
+    }
+    st->names_cnt = k;
+    if (st->name_nbucket) bucket_names();
+    bzero(st->ast_buf + n + 1, (st->ast_cnt - n) * sizeof(Node));
+    st->ast_cnt = n;
+}
+
+
+void defer_checks(bool on) { st->deferred = on; }
+bool checks_deferred()     { return st->deferred; }
+
+/*
+   typeof_AST() keeps the type of an operator, index or dereference on
+   the node.  changing a node drops the types kept on it and on the
+   expressions above it.
+ */
+static void forget_type(AST a) {
+    Node *np = &st->ast_buf[a];
+
+    np->etype = 0;
+    for (a = np->father; a; a = np->father) {
+	np = &st->ast_buf[a];
+	if (np->etype == 0) break;
+	np->etype = 0;
+    }
+}
+
+AST get_exprtype(AST a) {
+    return (a) ? st->ast_buf[a].etype : 0;
+}
+
+void set_exprtype(AST a, AST ty) {
+    if (a) st->ast_buf[a].etype = ty;
 }
 
 void set_node(AST a, int type, char *text, int ival) {
     Node *np;
 
     if (a==0) return;
-    np = &ast_buf[a];
-    np->type = type;
+    np = &st->ast_buf[a];
+    forget_type(a);
+    set_kind(a, type);
     np->text = text ;
     np->ival = ival;
+    if (type == nVREF) index_name(a, nVREF, text);
 }
 
 void get_node(AST a, int *type, char *text, int *ival) {
     Node *np;
 
     if (a==0) return;
-    np = &ast_buf[a];
+    np = &st->ast_buf[a];
     if (type) *type = np->type;
     if (text)  text = np->text;
     if (ival) *ival = np->ival;
@@ -90,18 +484,19 @@ void set_sons(AST a, AST s0, AST s1, AST s2, AST s3) {
     Node *np;
 
     if (a==0) return;
-    np = &ast_buf[a];
-    np->son[0] = s0; if (s0) ast_buf[s0].father = a;
-    np->son[1] = s1; if (s1) ast_buf[s1].father = a;
-    np->son[2] = s2; if (s2) ast_buf[s2].father = a;
-    np->son[3] = s3; if (s3) ast_buf[s3].father = a;
+    np = &st->ast_buf[a];
+    forget_type(a);
+    np->son[0] = s0; if (s0) st->ast_buf[s0].father = a;
+    np->son[1] = s1; if (s1) st->ast_buf[s1].father = a;
+    np->son[2] = s2; if (s2) st->ast_buf[s2].father = a;
+    np->son[3] = s3; if (s3) st->ast_buf[s3].father = a;
 }
 
 void get_sons(AST a, AST *s0, AST *s1, AST *s2, AST *s3) {
     Node *np;
 
     if (a==0) return;
-    np = &ast_buf[a];
+    np = &st->ast_buf[a];
     if (s0) *s0 = np->son[0]; 
     if (s1) *s1 = np->son[1]; 
     if (s2) *s2 = np->son[2]; 
@@ -121,30 +516,32 @@ void copy_AST(AST dst, AST src) {
 int nodetype(AST a) {
     Node *np;
     if (a==0) return 0;
-    np = &ast_buf[a];
+    np = &st->ast_buf[a];
     return np->type;
 }
 
 void set_nodetype(AST a,int n) {
     Node *np;
     if (a==0) return ;
-    np = &ast_buf[a];
-    np->type = n;
+    np = &st->ast_buf[a];
+    forget_type(a);
+    set_kind(a, n);
+    if (n == nVREF) index_name(a, nVREF, np->text);
 }
 
 AST make_AST(int type, AST s0, AST s1, AST s2, AST s3) {
     AST a = new_AST();
-    Node *np = &ast_buf[a];
 
-    np->type = type;
+    set_kind(a, type);
     set_sons(a, s0, s1, s2, s3);
+    if (type == nCALL) index_name(a, nCALL, get_text(s1));
     return a;
 }
 
 AST make_AST_prim(char *text) {
     AST a = new_AST();
     Node *np;
-    np = &ast_buf[a];
+    np = &st->ast_buf[a];
     np->type = tPRIM;
     np->text = text;
     np->ival = a;
@@ -154,7 +551,7 @@ AST make_AST_prim(char *text) {
 AST make_AST_void(char *text) {
     AST a = new_AST();
     Node *np;
-    np = &ast_buf[a];
+    np = &st->ast_buf[a];
     np->type = tVOID;
     np->text = text;
     np->ival = a;
@@ -164,7 +561,7 @@ AST make_AST_void(char *text) {
 AST make_AST_class(char *text){
     AST a = new_AST();
     Node *np;
-    np = &ast_buf[a];
+    np = &st->ast_buf[a];
     np->type = tCLASS;
     np->text = text;
     np->ival = a;
@@ -174,7 +571,7 @@ AST make_AST_class(char *text){
 AST make_AST_struct(char *text){
     AST a = new_AST();
     Node *np;
-    np = &ast_buf[a];
+    np = &st->ast_buf[a];
     np->type = tSTRUCT;
     np->text = text;
     np->ival = a;
@@ -216,7 +613,7 @@ AST make_AST_continue() {
 
 AST make_AST_vardecl(AST name, AST type) {
     AST a = new_AST();
-    Node *np = &ast_buf[a];
+    Node *np = &st->ast_buf[a];
     set_node(a, nVARDECL, 0, 0);
     if (name) np->son[0] = name;
     if (type) np->son[1] = type;
@@ -225,7 +622,7 @@ AST make_AST_vardecl(AST name, AST type) {
 
 AST make_AST_argdecl(AST name, AST type) {
     AST a = new_AST();
-    Node *np = &ast_buf[a];
+    Node *np = &st->ast_buf[a];
     set_node(a, nARGDECL, 0, 0);
     if (name) np->son[0] = name;
     if (type) np->son[1] = type;
@@ -234,13 +631,13 @@ AST make_AST_argdecl(AST name, AST type) {
 
 AST make_AST_funcdecl(AST name, AST type, AST args, AST block) {
     AST a = new_AST();
-    Node *np = &ast_buf[a];
-    Node *son = &ast_buf[type];
+    Node *np = &st->ast_buf[a];
     set_node(a, nFUNCDECL, 0, 0);
     if (name) np->son[0] = name;
     if (type) np->son[1] = type;
     if (args) np->son[2] = args;
     if (block) np->son[3] = block;
+    index_name(a, nFUNCDECL, get_text(name));
     return a;
 }
 
@@ -265,9 +662,9 @@ AST make_AST_vref(char *text,int val) {
 
 AST exists(char *text) {
     int i;
-    Node *np = &ast_buf[1];
+    Node *np = &st->ast_buf[1];
 
-    for (i=1;i<=ast_cnt;i++,np++) {
+    for (i=1;i<=st->ast_cnt;i++,np++) {
 	if ((np->type == nNAME || np->type == tPRIM || np->type == tVOID || np->type == tCLASS || np->type == tSTRUCT)
 		&& strcmp(text, np->text)==0) return i;
     }
@@ -286,40 +683,62 @@ AST make_AST_name(char *text) {
     return a;
 }
 
+/* the built-in type of literal token sym, 0 if it is none */
+AST littype_AST(int sym) {
+    switch (sym) {
+	case ILIT: return PRIM_INT;
+	case CLIT: return PRIM_CHAR;
+	case FLIT: return PRIM_FLOAT;
+	case SLIT: return PRIM_STRING;
+	default:   return 0;
+    }
+}
+
 AST make_AST_con(char *text, int val) {
     AST a = new_AST();
     set_node(a, nCON, text, val);
     return a;
 }
 
+/* the operand types are checked and converted by optype2(), optype1() */
 AST make_AST_op2(int op, AST s0, AST s1) {
-    if (!equaltype(s0, s1)) parse_error("Type mismatched between two arguments of operator");
+    AST ty = (st->deferred) ? 0 : optype2(op, &s0, &s1, 0);
     AST a = new_AST();
     set_node(a, nOP2, 0, op);
     set_sons(a, s0, s1, 0, 0);
+    set_exprtype(a, ty);
     return a;
 }
 
 AST make_AST_op0(int op, AST s){
-    checktypesingleop(s);
+    AST ty = (st->deferred) ? 0 : optype1(op, s);
     AST a = new_AST();
     set_node(a, nOP0, 0, op);
     set_sons(a, s, 0, 0, 0);
+    set_exprtype(a, ty);
     return a;
 }
 
 AST make_AST_op1(int op, AST s){
-    checktypesingleop(s);
+    AST ty = (st->deferred) ? 0 : optype1(op, s);
     AST a = new_AST();
     set_node(a, nOP1, 0, op);
     set_sons(a, s, 0, 0, 0);
+    set_exprtype(a, ty);
+    return a;
+}
+
+AST make_AST_conv(AST ty, AST s){
+    AST a = new_AST();
+    set_node(a, nCONV, 0, 0);
+    set_sons(a, ty, s, 0, 0);
     return a;
 }
 
 
 bool isleaf(AST a) {
     int i;
-    Node *np = &ast_buf[a];
+    Node *np = &st->ast_buf[a];
 
     for (i=0;i<4;i++) {
 	if (np->son[i]) return false;
@@ -328,43 +747,47 @@ bool isleaf(AST a) {
 }
 
 bool islist(AST a) {
-    Node *np = &ast_buf[a];
+    Node *np = &st->ast_buf[a];
 
     return nameof(np->type)[0] == '@';
 }
 
 char *get_text(AST a) {
-    Node *np = &ast_buf[a];
+    Node *np = &st->ast_buf[a];
     return (a && np->text) ? np->text : "";
 }
 
+int get_line(AST a) { return (a) ? st->ast_buf[a].line : 0; }
+int get_col(AST a)  { return (a) ? st->ast_buf[a].col : 0; }
+
 int get_ival(AST a) {
-    Node *np = &ast_buf[a];
+    Node *np = &st->ast_buf[a];
     return (a) ? np->ival : 0;
 }
 
 void set_ival(AST a, int v) {
-    Node *np = &ast_buf[a];
+    Node *np = &st->ast_buf[a];
+    if (a) forget_type(a);
     if (np) np->ival = v;
 }
 
 AST get_son0(AST a) {
-    Node *np = &ast_buf[a];
+    Node *np = &st->ast_buf[a];
     return (a) ? np->son[0] : 0;
 }
 
 AST get_father(AST a){
-    Node *np = &ast_buf[a];
+    Node *np = &st->ast_buf[a];
     return (a) ? np->father : 0;
 }
 
 static void set_son0(AST a, AST s0) {
-    Node *np = &ast_buf[a];
-    if (s0) np->son[0] = s0;
+    Node *np = &st->ast_buf[a];
+    if (s0) { forget_type(a); np->son[0] = s0; }
 }
 
 static void set_son1(AST a, AST s1) {
-    Node *np = &ast_buf[a];
+    Node *np = &st->ast_buf[a];
     if (s1) np->son[1] = s1;
 }
 
@@ -382,9 +805,9 @@ inline void set_argtypeofnode(AST a, AST t) {
 
 AST new_list(int type) {
     AST a = new_AST();
-    Node *np = &ast_buf[a];
+    Node *np = &st->ast_buf[a];
 
-    np->type = type;
+    set_kind(a, type);
     np->son[0] = np->son[1] = 0;
     return a;
 }
@@ -396,11 +819,11 @@ AST append_list(AST l, AST a1) {
     AST a=l, a2;
 
     if (l==0) return l;
-    np = &ast_buf[a];
+    np = &st->ast_buf[a];
     type = np->type;
     while (np->son[1]) {
 	a = np->son[1];
-	np = &ast_buf[a];
+	np = &st->ast_buf[a];
     }
     a2 = make_AST(type, 0, 0, 0, 0);
     set_sons(a,a1,a2,0,0);
@@ -542,10 +965,12 @@ static void print_Node_begin(Node *np)  {
 	    }
 	    break;
 	case nCON :
+	    /* pooled constants have no text, see name_SYM() */
+	    s = (np->text) ? np->text : name_SYM(np->ival);
 	    if (xml) {
-		printf(" val=\"%d\" name=\"%s\">", np->ival, np->text);
+		printf(" val=\"%d\" name=\"%s\">", np->ival, s);
 	    } else  {
-		printf("\"%s\"",  np->text);
+		printf("\"%s\"",  s);
 		printf("(%d)",    np->ival);
 	    }
 	    break;
@@ -577,7 +1002,7 @@ static void print_Node_end(Node *np) {
 }
 
 void print_AST(AST a) {
-    Node *np = &ast_buf[a];
+    Node *np = &st->ast_buf[a];
     int i;
 
     print_Node_begin(np); 
@@ -593,6 +1018,90 @@ void print_AST(AST a) {
     print_Node_end(np);
 }
 
+/*
+   frozen AST : a pre-order copy of the tree built after parsing.
+   the sons of entry i start at i+1, and the whole subtree rooted
+   at i is the range [i, i+size).  read-only passes can walk it
+   linearly instead of chasing son[] and father links in ast_buf.
+ */
+
+static int freeze_node(AST a, int slot) {
+    Node *np = &st->ast_buf[a];
+    Frozen *fp;
+    int i, k;
+
+    if (st->frozen_cnt >= st->frozen_max) {
+	st->frozen_max = (st->frozen_max) ? st->frozen_max * 2 : 256;
+	st->frozen = (Frozen *)realloc(st->frozen, st->frozen_max * sizeof(Frozen));
+    }
+    k = st->frozen_cnt++;
+    fp = &st->frozen[k];
+    fp->type = np->type;
+    fp->text = np->text;
+    fp->ival = np->ival;
+    fp->slot = slot;
+    fp->orig = a;
+
+    for (i=0;i<4;i++) {
+	if (np->son[i]) freeze_node(np->son[i], i);
+    }
+    st->frozen[k].size = st->frozen_cnt - k;	/* frozen may be moved by realloc */
+    return k;
+}
+
+int freeze_AST(AST root) {
+    st->frozen_cnt = 0;
+    freeze_node(root, 0);
+    return st->frozen_cnt;
+}
+
+int  frozen_count()      { return st->frozen_cnt; }
+int  frozen_type(int i)  { return st->frozen[i].type; }
+int  frozen_size(int i)  { return st->frozen[i].size; }
+AST  frozen_orig(int i)  { return st->frozen[i].orig; }
+
+static void frozen_to_Node(Frozen *fp, Node *np) {
+    bzero(np, sizeof(Node));
+    np->type = fp->type;
+    np->text = fp->text;
+    np->ival = fp->ival;
+}
+
+/* same output as print_AST(root), streaming through the frozen tree */
+void print_frozen_AST() {
+    int *stack;
+    int sp = 0;
+    int i = 0;
+    Node n;
+
+    stack = (int *)malloc((st->frozen_cnt+1) * sizeof(int));
+    while (i < st->frozen_cnt) {
+	Frozen *fp = &st->frozen[i];
+
+	while (sp > 0 && i >= stack[sp-1] + st->frozen[stack[sp-1]].size) {
+	    frozen_to_Node(&st->frozen[stack[--sp]], &n);
+	    print_Node_end(&n);
+	}
+	if (sp > 0) {
+	    Frozen *pp = &st->frozen[stack[sp-1]];
+	    if (eliminate_null_list && fp->size == 1 && nameof(fp->type)[0] == '@') {
+		i += fp->size;
+		continue;
+	    }
+	    if (!xml && fp->slot) printf(",");
+	    if (pp->type == nIF && fp->slot >= 1) printf("\n");
+	}
+	frozen_to_Node(fp, &n);
+	print_Node_begin(&n);
+	stack[sp++] = i++;
+    }
+    while (sp > 0) {
+	frozen_to_Node(&st->frozen[stack[--sp]], &n);
+	print_Node_end(&n);
+    }
+    free(stack);
+}
+
 void dump_sons(Node *np,FILE *fp) {
     int i;
     fprintf(fp,"[");
@@ -605,9 +1114,9 @@ void dump_sons(Node *np,FILE *fp) {
 
 void dump_AST(FILE *fp) {
     int i;
-    fprintf(fp,"AST:cnt=%d\n", ast_cnt);
-    for (i=5;i<=ast_cnt;i++) {
-	Node *np = &ast_buf[i];
+    fprintf(fp,"AST:cnt=%d\n", st->ast_cnt);
+    for (i=5;i<=st->ast_cnt;i++) {
+	Node *np = &st->ast_buf[i];
 	char *s = nameof(np->type);
 	if (s && s[0] == '@') s++;
 	fprintf(fp,"%4d:",i);
@@ -651,12 +1160,13 @@ int restore_AST(FILE *fp) {
     return 0;
 
 top:
-    sscanf(buf, "AST:cnt=%d\n", &ast_cnt);
-    for (i=5;i<=ast_cnt;i++) {
+    sscanf(buf, "AST:cnt=%d\n", &st->ast_cnt);
+    grow_AST(st->ast_cnt);
+    for (i=5;i<=st->ast_cnt;i++) {
 	bzero(kind,40); bzero(text,40);
 
 	fscanf(fp,"%4d:", &k);
-	np = &ast_buf[i];
+	np = &st->ast_buf[i];
 
 	fscanf(fp,"<%s %s %d %d>[%d %d %d %d]\n",
 		kind, text,  &(np->ival), &(np->father),
@@ -664,5 +1174,6 @@ top:
 	np->type = nodetypeval(kind);
 	np->text = strdup(text);
     }
-    return ast_cnt;
+    index_nodes(5, st->ast_cnt);
+    return st->ast_cnt;
 }
@@ -1,7 +1,7 @@
 #ifndef _AST_H_
 #define _AST_H_
 
-#define MAX_AST_NODE 1000
+#define MAX_AST_NODE 1000	/* initial size, ast_buf grows on demand */
 
 // typedef struct Node *AST;
 typedef int AST;
@@ -20,6 +20,7 @@ typedef enum {
   nOP0, nOP1, nOP2, nDEREF, nLVAL,
   nCALL, nRET, nBREAK, nCONTINUE,
   nVARS, nVAR, nCON, nNAME, 
+  nCONV,			/* implicit conversion : son0 type, son1 expr */
   nEND, nERROR = -1
 } node_type;
 
@@ -29,18 +30,56 @@ typedef struct Node {
   int       ival;
   AST       father;
   AST       son[4];
+  AST       etype;	/* type of an expression, once known */
+  int       line;	/* source position when the node was made */
+  int       col;
+  int       kpos;	/* 1 + place in the list of its kind, 0 if none */
+  int       nent;	/* 1 + its entry in the name index, 0 if none */
 } Node ;
 
+/* the built-in type nodes, made first by init_AST() in this order */
+enum { PRIM_INT=1, PRIM_CHAR, PRIM_FLOAT, PRIM_STRING, PRIM_VOID };
+
+/* pre-order (frozen) copy of a tree, see freeze_AST() */
+typedef struct Frozen {
+  node_type type;
+  char      *text;
+  int       ival;
+  int       size;	/* entries in the subtree, including itself */
+  int       slot;	/* index in son[] of its father */
+  AST       orig;	/* node in ast_buf */
+} Frozen;
+
+/* the nodes of one context, see context.h */
+typedef struct AST_state AST_state;
+AST_state *new_AST_state(void);
+void init_AST(void);
+void use_AST(AST_state *);
+AST_state *cur_AST(void);
+void free_AST(AST_state *);
+void fork_AST(AST_state *);
+int  splice_AST(AST_state *, AST);
+void rollback_AST(AST);
+void move_lines_AST(int, int);
+
 void set_node(AST a, int type, char *text, int ival);
 void get_node(AST a, int *type, char *text, int *ival);
 void set_sons(AST a, AST s0, AST s1, AST s2, AST s3);
 void get_sons(AST a, AST *s0, AST *s1, AST *s2, AST *s3);
+AST  get_son0(AST);
+AST  get_father(AST);
 
 int make_AST(int,AST,AST,AST,AST); /* type, son[0..3] */
+int count_AST(void);
 
 int make_AST_name(char*);
 int make_AST_var(char*,int);
 int make_AST_con(char*,int);
+AST littype_AST(int);
+int make_AST_conv(AST,AST);
+int make_AST_op0(int,AST);
+int make_AST_op1(int,AST);
+int make_AST_op2(int,AST,AST);
 void copy_AST(AST dst, AST src);
 
 AST new_list(int);
@@ -50,16 +89,39 @@ void print_AST(AST);
 bool isleaf(AST);
 bool islist(AST);
 char  *get_text(AST);
+int   get_line(AST);
+int   get_col(AST);
 void   set_text(AST,char*);
 int   get_ival(AST);
 void  set_ival(AST,int);
 int   nodetype(AST);
 void  set_nodetype(AST,int);
 
+/* leave type checks to the semantic pass, see sema.c */
+void  defer_checks(bool);
+bool  checks_deferred(void);
+
+/* memoized type of an expression, see typeof_AST() */
+AST   get_exprtype(AST);
+void  set_exprtype(AST,AST);
+
 /* for tFUNC */
+AST  get_typeofnode(AST);
 void set_typeofnode(AST,AST);
 void set_argtypeofnode(AST,AST);
 
+/* node index */
+int  select_AST(int kind, AST *out, int max);
+int  select_AST_name(int kind, char *name, AST *out, int max);
+int  check_index_AST(FILE*);
+
+int  freeze_AST(AST);
+int  frozen_count(void);
+int  frozen_type(int);
+int  frozen_size(int);
+AST  frozen_orig(int);
+void print_frozen_AST(void);
+
 void dump_AST(FILE*);
 int  restore_AST(FILE*);
 
@@ -0,0 +1,53 @@
+//
+// context.c -- the tables of one parse, bound per thread
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include "context.h"
+
+static __thread Context *bound;
+
+/* a fresh context reading from in; it is left bound to the caller */
+Context *new_context(FILE *in) {
+    Context *cx = (Context *)calloc(1, sizeof(Context));
+
+    cx->tok = new_TOK_state();
+    cx->ast = new_AST_state();
+    cx->sym = new_SYM_state();
+    cx->loc = new_LOC_state();
+    cx->type = new_TYPE_state();
+    cx->diff = new_DIFF_state();
+    use_context(cx);
+
+    set_input(in);
+    initline();
+    init_AST();
+    init_SYM();
+    init_LOC();
+    return cx;
+}
+
+/* bind cx to the calling thread, or the tables of the process if 0 */
+void use_context(Context *cx) {
+    bound = cx;
+    use_TOK((cx) ? cx->tok : 0);
+    use_AST((cx) ? cx->ast : 0);
+    use_SYM((cx) ? cx->sym : 0);
+    use_LOC((cx) ? cx->loc : 0);
+    use_TYPE((cx) ? cx->type : 0);
+    use_DIFF((cx) ? cx->diff : 0);
+}
+
+Context *cur_context() { return bound; }
+
+void free_context(Context *cx) {
+    if (cx == 0) return;
+    if (cx == bound) use_context(0);
+    free_TOK(cx->tok);
+    free_AST(cx->ast);
+    free_SYM(cx->sym);
+    free_LOC(cx->loc);
+    free_TYPE(cx->type);
+    free_DIFF(cx->diff);
+    free(cx);
+}
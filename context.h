@@ -0,0 +1,31 @@
+#ifndef _CONTEXT_H_
+#define _CONTEXT_H_
+#include <stdio.h>
+#include "token.h"
+#include "ast.h"
+#include "sym.h"
+#include "loc.h"
+#include "type.h"
+#include "diff.h"
+
+/*
+   the tables of one parse.  a thread works on the context it has bound
+   with use_context(); threads with contexts of their own can parse at
+   the same time.  a thread that never binds one uses the tables of the
+   process, as a single parse always did.
+ */
+typedef struct Context {
+    TOK_state  *tok;
+    AST_state  *ast;
+    SYM_state  *sym;
+    LOC_state  *loc;
+    TYPE_state *type;
+    DIFF_state *diff;
+} Context;
+
+Context *new_context(FILE *);
+void use_context(Context *);
+Context *cur_context(void);
+void free_context(Context *);
+
+#endif
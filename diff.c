@@ -0,0 +1,339 @@
+//
+// diff.c -- structural diff of two compilations
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <strings.h>
+#include "ast.h"
+#include "sym.h"
+#include "type.h"
+#include "token.h"
+#include "diff.h"
+
+/*
+   Each subtree gets a Merkle hash over its node kind, its text and the
+   hashes of its sons.  Generated names ($Cnnnn, $Tnnnn, $Fnnnn) and
+   symbol numbers are left out, so the hash only changes when the
+   source of the subtree changes.
+
+   dump_SIG() writes one line per class and function :
+     class <name> <hash>
+     func  <class>.<name>(<argtypes>) <hash>
+   The hash of a class leaves out its functions and nested classes,
+   which have lines of their own.  names are cut to MAX_SIGNAME-1
+   characters, the same when written and read.  diff_SIG() compares two
+   dumps and reports the changed, added and removed entries, looking
+   them up in a sorted copy.
+ */
+
+/* hashes already worked out, per context (see context.c) */
+struct DIFF_state {
+    unsigned *hash_memo;
+    int       hash_max;
+};
+
+static DIFF_state main_state;
+static __thread DIFF_state *st = &main_state;
+
+DIFF_state *new_DIFF_state()       { return (DIFF_state *)calloc(1, sizeof(DIFF_state)); }
+void use_DIFF(DIFF_state *s) { st = (s) ? s : &main_state; }
+DIFF_state *cur_DIFF()       { return st; }
+
+void free_DIFF(DIFF_state *s) {
+    free(s->hash_memo);
+    if (s != &main_state) free(s);
+}
+static unsigned mix(unsigned h, unsigned v) {
+    h ^= v;
+    h *= 16777619u;
+    return h ^ (h >> 15);
+}
+
+static unsigned mix_str(unsigned h, char *s) {
+    if (s == 0) return mix(h, 0);
+    while (*s) h = mix(h, (unsigned char)*s++);
+    return mix(h, 0xff);
+}
+
+static unsigned hash_con(AST a) {
+    unsigned h = 0;
+    char *s = get_text(a);
+    int idx;
+
+    if (s[0])			/* true, false */
+	return mix_str(h, s);
+    idx = get_ival(a);
+    h = mix(h, gettype_SYM(idx));
+    if (gettype_SYM(idx) == 0)	/* immediate */
+	return mix(h, getval_SYM(idx));
+    return mix_str(h, get_STR(getval_SYM(idx)));
+}
+
+static unsigned hash_node(AST a) {
+    unsigned h = 2166136261u;
+    AST s[4];
+    int i, ty = nodetype(a);
+
+    h = mix(h, ty);
+    switch (ty) {
+	case nCON:
+	    h = mix(h, hash_con(a));
+	    break;
+	case nOP0: case nOP1: case nOP2: case nASN:
+	case tARRAY:
+	    h = mix(h, get_ival(a));
+	    break;
+	case tFUNC:
+	    break;
+	default:
+	    h = mix_str(h, get_text(a));
+	    break;
+    }
+    get_sons(a, &s[0], &s[1], &s[2], &s[3]);
+    for (i=0;i<4;i++) {
+	h = mix(h, (s[i]) ? hash_AST(s[i]) : 0);
+    }
+    return h ? h : 1;
+}
+
+unsigned hash_AST(AST a) {
+    if (a == 0) return 0;
+    if (a >= st->hash_max) {
+	int n = (a+1) * 2;
+	st->hash_memo = (unsigned *)realloc(st->hash_memo, n * sizeof(unsigned));
+	bzero(st->hash_memo + st->hash_max, (n - st->hash_max) * sizeof(unsigned));
+	st->hash_max = n;
+    }
+    if (st->hash_memo[a] == 0) {
+	unsigned h = hash_node(a);	/* may grow hash_memo */
+	st->hash_memo[a] = h;
+    }
+    return st->hash_memo[a];
+}
+
+/* hash of a class without its functions and nested classes */
+static unsigned hash_shallow(AST a) {
+    unsigned h = 2166136261u;
+    AST s[4];
+    int i, ty = nodetype(a);
+
+    switch (ty) {
+	case nFUNCDECLS: case nCLASSDECLS:
+	    return 1;
+	case nCLASSDECL: case nCLASSBODY:
+	    break;
+	default:
+	    return hash_AST(a);
+    }
+    h = mix(h, ty);
+    get_sons(a, &s[0], &s[1], &s[2], &s[3]);
+    for (i=0;i<4;i++) {
+	h = mix(h, (s[i]) ? hash_shallow(s[i]) : 0);
+    }
+    return h;
+}
+
+/* append to a name of MAX_SIGNAME bytes, cut if too long */
+static void add_name(char *buf, const char *fmt, ...) {
+    int len = strlen(buf);
+    va_list ap;
+
+    va_start(ap, fmt);
+    vsnprintf(buf + len, MAX_SIGNAME - len, fmt, ap);
+    va_end(ap);
+}
+
+static void sprint_type(char *buf, AST ty) {
+    switch (nodetype(ty)) {
+	case tARRAY:
+	    sprint_type(buf, get_son0(ty));
+	    add_name(buf, "[%d]", get_ival(ty));
+	    break;
+	case tPOINTER:
+	    sprint_type(buf, get_son0(ty));
+	    add_name(buf, "*");
+	    break;
+	default:
+	    add_name(buf, "%s", get_text(ty));
+	    break;
+    }
+}
+
+static void sig_funcname(char *buf, char *cls, AST f) {
+    AST name = 0, args = 0, arg = 0, ty = 0;
+    int first = 1;
+
+    get_sons(f, &name, 0, &args, 0);
+    buf[0] = 0;
+    add_name(buf, "%s.%s(", cls, get_text(name));
+    while (args) {
+	get_sons(args, &arg, &args, 0, 0);
+	if (arg == 0) break;
+	if (!first) add_name(buf, ",");
+	first = 0;
+	get_sons(arg, 0, &ty, 0, 0);
+	sprint_type(buf, ty);
+    }
+    add_name(buf, ")");
+}
+
+static void dump_funcs(FILE *fp, char *cls, AST l) {
+    char buf[MAX_SIGNAME];
+    AST f = 0;
+
+    while (l) {
+	get_sons(l, &f, &l, 0, 0);
+	if (f == 0) break;
+	sig_funcname(buf, cls, f);
+	fprintf(fp, "func %s %08x\n", buf, hash_AST(f));
+    }
+}
+
+static void dump_classes(FILE *fp, char *outer, AST l) {
+    char buf[MAX_SIGNAME];
+    AST c = 0, head = 0, body = 0, nested = 0, funcs = 0;
+
+    while (l) {
+	get_sons(l, &c, &l, 0, 0);
+	if (c == 0) break;
+	get_sons(c, &head, &body, 0, 0);
+	buf[0] = 0;
+	if (outer) add_name(buf, "%s.%s", outer, get_text(get_son0(head)));
+	else       add_name(buf, "%s", get_text(get_son0(head)));
+	fprintf(fp, "class %s %08x\n", buf, hash_shallow(c));
+
+	get_sons(body, 0, &nested, 0, &funcs);
+	dump_funcs(fp, buf, funcs);
+	dump_classes(fp, buf, nested);
+    }
+}
+
+void dump_SIG(FILE *fp, AST root) {
+    fprintf(fp, "SIG:\n");
+    dump_classes(fp, 0, get_son0(root));
+    fprintf(fp, "\n");
+}
+
+#define STR(x)  #x
+#define WIDTH(x) STR(x)
+
+int restore_SIG(FILE *fp, sigentry **sigs) {
+    char buf[MAX_SIGNAME+32];
+    char kind[10];
+    sigentry *v = 0;
+    int cnt = 0, max = 0;
+
+    while (fgets(buf, sizeof(buf), fp)) {
+	if (strncmp(buf, "SIG:", 4) == 0) goto top;
+    }
+    *sigs = 0;
+    return 0;
+
+top:
+    while (fgets(buf, sizeof(buf), fp)) {
+	sigentry *ep;
+	if (cnt >= max) {
+	    max = (max) ? max * 2 : 64;
+	    v = (sigentry *)realloc(v, max * sizeof(sigentry));
+	}
+	ep = &v[cnt];
+	if (sscanf(buf, "%9s %" WIDTH(MAX_SIGNAME_LEN) "s %x", kind, ep->name, &ep->hash) != 3) break;
+	ep->kind = (strcmp(kind, "class") == 0) ? nCLASSDECL : nFUNCDECL;
+	cnt++;
+    }
+    *sigs = v;
+    return cnt;
+}
+
+static int by_sig(const void *p1, const void *p2) {
+    const sigentry *s1 = *(sigentry * const *)p1, *s2 = *(sigentry * const *)p2;
+    if (s1->kind != s2->kind) return s1->kind - s2->kind;
+    return strcmp(s1->name, s2->name);
+}
+
+/* the entries of v by kind and name, for find_sig() */
+static sigentry **sort_sigs(sigentry *v, int n) {
+    sigentry **by = (sigentry **)malloc((n+1) * sizeof(sigentry *));
+    int i;
+
+    for (i=0;i<n;i++) by[i] = &v[i];
+    qsort(by, n, sizeof(sigentry *), by_sig);
+    return by;
+}
+
+static sigentry *find_sig(sigentry **by, int n, int kind, char *name) {
+    int lo = 0, hi = n-1, mid, c;
+
+    while (lo <= hi) {
+	mid = (lo + hi) / 2;
+	c = (by[mid]->kind != kind) ? by[mid]->kind - kind : strcmp(by[mid]->name, name);
+	if (c == 0) return by[mid];
+	if (c < 0) lo = mid+1;
+	else hi = mid-1;
+    }
+    return 0;
+}
+
+/* s is a member of a class not in by, which is reported instead */
+static bool inside(sigentry *s, sigentry **by, int n) {
+    char buf[MAX_SIGNAME];
+    int i;
+
+    for (i=0;s->name[i] && s->name[i] != '(';i++) {
+	if (s->name[i] != '.') continue;
+	memcpy(buf, s->name, i);
+	buf[i] = 0;
+	if (find_sig(by, n, nCLASSDECL, buf) == 0) return true;
+    }
+    return false;
+}
+
+static int report(FILE *out, char *what, sigentry *v, int n, sigentry **by, int m) {
+    int i, cnt = 0;
+    for (i=0;i<n;i++) {
+	sigentry *s = &v[i];
+	if (find_sig(by, m, s->kind, s->name) || inside(s, by, m)) continue;
+	fprintf(out, "%s %s %s\n", what, (s->kind == nCLASSDECL) ? "class" : "func", s->name);
+	cnt++;
+    }
+    return cnt;
+}
+
+/* prints changed, added and removed classes and functions */
+int diff_SIG(FILE *oldfp, FILE *newfp, FILE *out) {
+    sigentry *ov, *nv, *s, *o;
+    sigentry **oby, **nby;
+    int on, nn, i, cnt = 0;
+
+    on = restore_SIG(oldfp, &ov);
+    nn = restore_SIG(newfp, &nv);
+    oby = sort_sigs(ov, on);
+    nby = sort_sigs(nv, nn);
+
+    cnt += report(out, "removed", ov, on, nby, nn);
+    cnt += report(out, "added",   nv, nn, oby, on);
+    for (i=0;i<nn;i++) {
+	s = &nv[i];
+	if ((o = find_sig(oby, on, s->kind, s->name)) == 0 || o->hash == s->hash) continue;
+	fprintf(out, "changed %s %s\n", (s->kind == nCLASSDECL) ? "class" : "func", s->name);
+	cnt++;
+    }
+    free(oby); free(nby); free(ov); free(nv);
+    return cnt;
+}
+
+#ifdef TEST_DIFF
+int main(int argc, char **argv) {
+    FILE *oldfp, *newfp;
+
+    if (argc != 3) {
+	fprintf(stderr, "usage: %s old new\n", argv[0]);
+	return 2;
+    }
+    if ((oldfp = fopen(argv[1], "r")) == 0) { perror(argv[1]); return 2; }
+    if ((newfp = fopen(argv[2], "r")) == 0) { perror(argv[2]); return 2; }
+    return diff_SIG(oldfp, newfp, stdout) ? 1 : 0;
+}
+#endif
@@ -0,0 +1,29 @@
+#ifndef _DIFF_H_
+#define _DIFF_H_
+#include <stdio.h>
+#include "ast.h"
+
+#define MAX_SIGNAME 256
+#define MAX_SIGNAME_LEN 255	/* MAX_SIGNAME-1, for the scanf width */
+
+/* signature of a class or function : name and structural hash */
+typedef struct sigentry {
+    int      kind;	/* nCLASSDECL or nFUNCDECL */
+    char     name[MAX_SIGNAME];
+    unsigned hash;
+} sigentry;
+
+/* the hash memo of one context, see context.h */
+typedef struct DIFF_state DIFF_state;
+DIFF_state *new_DIFF_state(void);
+void use_DIFF(DIFF_state *);
+DIFF_state *cur_DIFF(void);
+void free_DIFF(DIFF_state *);
+
+unsigned hash_AST(AST);
+
+void dump_SIG(FILE*, AST);
+int  restore_SIG(FILE*, sigentry**);
+int  diff_SIG(FILE*, FILE*, FILE*);
+
+#endif
@@ -0,0 +1,179 @@
+//
+// expr.c -- expressions of both parsers, by precedence climbing
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "token.h"
+#include "ast.h"
+#include "parser.h"
+
+/*
+   expr      ::= unary [ binop unary ]*
+   unary     ::= prefix unary | DUPOP lval | lval DUPOP? | con
+	       | TRUE | FALSE | '(' expr ')'
+   prefix    ::= '+' | '-' | '!' | '~'
+
+   binary() takes the operators of an expression from the left.  The
+   right operand of an operator is read by a call of binary() that only
+   takes operators binding tighter, so an expression costs one call per
+   operator instead of one per level of precedence.  The leaves come
+   from the lval() and con() of the parser.
+ */
+
+/*
+   where to pick up after an error, from FOLLOW(unary) and FOLLOW(expr).
+   a missing ; puts FOLLOW(stmt) there too, but not ID : an ID stops
+   too soon to be worth it.
+ */
+static const int unary_sync[] = {
+    ARIOP, RELOP, LOGOP,
+    ';', ',', ')', ']', ASNOP, '{', tIF, tELSE, tWHILE, tRETURN, 0
+};
+static const int expr_sync[] = {
+    ';', ',', ')', ']', ASNOP, '{', tIF, tELSE, tWHILE, tRETURN, 0
+};
+
+/* binding power of the binary operators by ival, higher binds tighter */
+static const char binprec[256] = {
+    [OROR]   = 1,
+    [XORXOR] = 2,
+    [ANDAND] = 3,
+    ['|']    = 4,
+    ['^']    = 5,
+    ['&']    = 6,
+    [EQEQ]   = 7, [NOTEQ] = 7,
+    ['<']    = 8, ['>']   = 8, [LTEQ] = 8, [GTEQ] = 8,
+    [LSHIFT] = 9, [RSHIFT] = 9,
+    ['+']    = 10, ['-']  = 10,
+    ['*']    = 11, ['/']  = 11, ['%'] = 11,
+};
+
+#define ADD_PREC 10
+#define MUL_PREC 11
+
+static AST binary(Parser *, int);
+
+/* the operator at t and its binding power, 0 if t is none */
+static int precof(Token *t, int *op) {
+    switch (t->sym) {
+	case ARIOP: case RELOP: case LOGOP:
+	    *op = t->ival;
+	    return (*op > 0 && *op < 256) ? binprec[*op] : 0;
+	case ILIT:	/* a+1 => ID<a> ILIT<+1> , same as OP<+> */
+	    *op = '+';
+	    return ADD_PREC;
+	case '(':	/* a (b) : the operator is missing */
+	    *op = '*';
+	    return MUL_PREC;
+	default:
+	    return 0;
+    }
+}
+
+/* returns 'zero' if parse_error occurs */
+static AST unary(Parser *p) {
+    Token *t = p->t;
+    AST a;
+    int op;
+
+    switch (t->sym) {
+	case DUPOP:
+	    op = t->ival;
+	    gettoken();
+	    a = p->lval(p);
+	    return make_AST_op1(op, a);
+	case ID:
+	    a = p->lval(p);
+	    if (t->sym == DUPOP) {
+		a = make_AST_op0(t->ival, a);
+		gettoken();
+	    }
+	    return a;
+	case ILIT: case CLIT: case FLIT: case SLIT:
+	    return p->con(p);
+	case tTRUE: case tFALSE:
+	    a = make_AST_con(strdup(t->text), t->sym == tTRUE);
+	    gettoken();
+	    return a;
+	case '(':
+	    gettoken();
+	    a = binary(p, 0);
+	    if (t->sym == ')') gettoken();
+	    else parse_error("expected )");
+	    return a;
+	case ARIOP:
+	    if (t->ival != '+' && t->ival != '-') break;
+	    op = t->ival;
+	    gettoken();
+	    return make_AST_op1(op, unary(p));
+	case LOGOP:
+	    if (t->ival != '!') break;
+	    gettoken();
+	    return make_AST_op1('!', unary(p));
+	case '~':
+	    gettoken();
+	    return make_AST_op1('~', unary(p));
+    }
+    parse_error("expected ID or LIT");
+    skipto(unary_sync);
+    return p->zero;
+}
+
+/* what may follow a whole expression */
+static void follow(Parser *p) {
+    Token *t = p->t;
+
+    switch (t->sym) {
+	case ';': case ',': case ')': case ']':
+	case ASNOP:	/* this should be an assignment */
+	    return;
+	case ID: case tIF: case tELSE: /* FOLLOW(expr) when ; is missing */
+	    parse_error("purhaps missing ;");
+	    return;
+	default:
+	    parse_error("expected op");
+	    skipto(expr_sync);
+	    return;
+    }
+}
+
+/* an expression of the operators binding at least min; 0 for all */
+static AST binary(Parser *p, int min) {
+    Token *t = p->t;
+    AST a, a2;
+    int op, prec;
+
+    a = unary(p);
+    while (true) {
+	if ((prec = precof(t, &op)) == 0) {
+	    if (min == 0) follow(p);
+	    return a;
+	}
+	if (prec < min) return a;
+
+	switch (t->sym) {
+	    case ILIT:
+		/* when LIT does not begin with +/-, it is missing */
+		if (t->text[0] != '+' && t->text[0] != '-')
+		    parse_error("expected + or -");
+		break;
+	    case '(':
+		parse_error("purhaps missing * or /");
+		break;
+	    default:
+		gettoken();
+		break;
+	}
+	a2 = binary(p, prec+1);
+	a = make_AST_op2(op, a, a2); /* left associative */
+    }
+}
+
+AST parse_expr(Parser *p) {
+    Token *t = p->t;
+
+    /* when missing both ID/LIT and ; FOLLOW(stmt) may appear */
+    if (t->sym == tIF || t->sym == tELSE) return p->zero;
+    return binary(p, 0);
+}
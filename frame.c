@@ -0,0 +1,335 @@
+//
+// frame.c -- stack slot sharing for the locals of a function
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ast.h"
+#include "sym.h"
+#include "loc.h"
+#include "type.h"
+#include "frame.h"
+
+/*
+   insert_SYM() gives every local a slot of its own block.  layout_frame()
+   walks a function body in source order and numbers the nodes; the live
+   range of a local runs from its declaration to its last reference.  A
+   reference inside a while loop that does not contain the declaration
+   keeps the local alive to the end of that loop.  The ranges are then
+   packed first-fit into a single frame at the depth of the body, so
+   locals whose ranges do not meet share a slot.
+ */
+
+typedef struct local {
+    int  sym;
+    char *name;
+    int  size;
+    int  align;
+    int  start, end;	/* live range */
+    int  loop;		/* last loop it is live across, or -1 */
+    int  offset;	/* assigned slot */
+} local;
+
+typedef struct loop {
+    int start, end;
+} loop;
+
+typedef struct item {
+    AST a;		/* node to visit, or 0 to close loop */
+    int loop;
+} item;
+
+/* scratch space, one per thread */
+static __thread local *locals;
+static __thread int local_cnt, local_max;
+static __thread loop *loops;
+static __thread int loop_cnt, loop_max;
+static __thread int *open_loops;	/* loops around the current node, outermost first */
+static __thread int open_cnt;
+static __thread item *stack;
+static __thread int stack_cnt, stack_max;
+
+static void push(AST a, int lp) {
+    if (stack_cnt >= stack_max) {
+	stack_max = (stack_max) ? stack_max * 2 : 256;
+	stack = (item *)realloc(stack, stack_max * sizeof(item));
+    }
+    stack[stack_cnt].a = a;
+    stack[stack_cnt].loop = lp;
+    stack_cnt++;
+}
+
+static void add_local(int k, char *name, int pos) {
+    local *lp;
+    if (local_cnt >= local_max) {
+	local_max = (local_max) ? local_max * 2 : 64;
+	locals = (local *)realloc(locals, local_max * sizeof(local));
+    }
+    lp = &locals[local_cnt++];
+    lp->sym = k;
+    lp->name = name;
+    lp->size = getsize_LOC(getloc_SYM(k));
+    lp->align = get_alignoftype(gettype_SYM(k));
+    lp->start = lp->end = pos;
+    lp->loop = -1;
+    lp->offset = 0;
+}
+
+static int open_loop(int pos) {
+    if (loop_cnt >= loop_max) {
+	loop_max = (loop_max) ? loop_max * 2 : 16;
+	loops = (loop *)realloc(loops, loop_max * sizeof(loop));
+	open_loops = (int *)realloc(open_loops, loop_max * sizeof(int));
+    }
+    loops[loop_cnt].start = pos;
+    loops[loop_cnt].end = pos;
+    open_loops[open_cnt++] = loop_cnt;
+    return loop_cnt++;
+}
+
+/* locals are declared in symbol order, so they can be searched */
+static local *find_local(int k) {
+    int lo = 0, hi = local_cnt-1;
+    while (lo <= hi) {
+	int mid = (lo + hi) / 2;
+	if (locals[mid].sym == k) return &locals[mid];
+	if (locals[mid].sym < k) lo = mid+1;
+	else hi = mid-1;
+    }
+    return 0;
+}
+
+static void use_local(local *lp, int pos) {
+    int i;
+    lp->end = pos;
+    for (i=0;i<open_cnt;i++) {
+	if (loops[open_loops[i]].start > lp->start) {
+	    lp->loop = open_loops[i];	/* ends no earlier than the last one */
+	    break;
+	}
+    }
+}
+
+/* a reference : by symbol, or by name if it was never resolved */
+static void use(AST a, int pos) {
+    local *lp;
+    int i;
+
+    if (get_ival(a) && (lp = find_local(get_ival(a)))) {
+	use_local(lp, pos);
+	return;
+    }
+    for (i=0;i<local_cnt;i++)
+	if (strcmp(locals[i].name, get_text(a)) == 0) use_local(&locals[i], pos);
+}
+
+static void live_ranges(AST body) {
+    AST s[4];
+    int pos = 0;
+    int i, kind;
+
+    stack_cnt = 0;
+    push(body, 0);
+    while (stack_cnt > 0) {
+	item it = stack[--stack_cnt];
+	if (it.a == 0) {
+	    loops[it.loop].end = pos;
+	    open_cnt--;
+	    continue;
+	}
+	kind = nodetype(it.a);
+	if (kind < nPROG || kind >= nEND) continue;	/* types */
+	if (kind == nFUNCDECL && it.a != body) continue;	/* own frame */
+	pos++;
+
+	switch (kind) {
+	    case nVAR:
+		if (get_ival(it.a) && getprop_SYM(get_ival(it.a)) == vLOCAL)
+		    add_local(get_ival(it.a), get_text(it.a), pos);
+		break;
+	    case nVREF:
+		use(it.a, pos);
+		break;
+	    case nWHILE:
+		push(0, open_loop(pos));
+		break;
+	}
+	get_sons(it.a, &s[0], &s[1], &s[2], &s[3]);
+	for (i=3;i>=0;i--)
+	    if (s[i]) push(s[i], 0);
+    }
+
+    for (i=0;i<local_cnt;i++) {
+	local *lp = &locals[i];
+	if (lp->loop >= 0 && loops[lp->loop].end > lp->end)
+	    lp->end = loops[lp->loop].end;
+    }
+}
+
+static int align(int off, int al) {
+    return (al > 1) ? (off + al-1) / al * al : off;
+}
+
+/* first-fit : the lowest aligned offset clear of every local still live */
+static int assign_slots() {
+    static __thread int *active;	/* live locals, by offset */
+    static __thread int active_max;
+    int active_cnt = 0;
+    int i, j, n, frame = 0;
+
+    if (active_max < local_cnt) {
+	active_max = local_cnt;
+	active = (int *)realloc(active, active_max * sizeof(int));
+    }
+    for (i=0;i<local_cnt;i++) {
+	local *lp = &locals[i];
+	int off = 0;
+
+	for (j=n=0;j<active_cnt;j++)
+	    if (locals[active[j]].end >= lp->start) active[n++] = active[j];
+	active_cnt = n;
+
+	for (j=0;j<active_cnt;j++) {
+	    local *q = &locals[active[j]];
+	    if (off + lp->size <= q->offset) break;
+	    if (off < q->offset + q->size) off = align(q->offset + q->size, lp->align);
+	}
+	lp->offset = off;
+	memmove(&active[j+1], &active[j], (active_cnt - j) * sizeof(int));
+	active[j] = i;
+	active_cnt++;
+	if (off + lp->size > frame) frame = off + lp->size;
+    }
+    return frame;
+}
+
+/* lay out the locals of a function body; returns the frame size */
+int layout_frame(AST body) {
+    int i, depth = 0, frame;
+
+    local_cnt = loop_cnt = open_cnt = 0;
+    if (body == 0) return 0;
+
+    live_ranges(body);
+    if (local_cnt == 0) return 0;
+
+    for (i=0;i<local_cnt;i++) {
+	int d = getdepth_SYM(locals[i].sym);
+	if (i == 0 || d < depth) depth = d;
+    }
+    frame = assign_slots();
+
+    for (i=0;i<local_cnt;i++) {
+	local *lp = &locals[i];
+	int e = lookup_loc_entry(depth, lp->offset, lp->size);
+	set_loc_entry(e, depth, lp->offset, lp->size);
+	setloc_SYM(lp->sym, e);
+    }
+    return frame;
+}
+
+/*
+   record layout : the fields of a struct or class are sorted by
+   alignment, largest first, so they pack without padding between them;
+   within an alignment the fields referenced most often by the methods
+   of the class come first and end up next to each other.
+ */
+typedef struct field {
+    int sym;
+    int size;
+    int align;
+    int uses;
+} field;
+
+static __thread field *fields;
+static __thread int field_cnt, field_max;
+
+static void add_field(int k) {
+    field *fp;
+    if (field_cnt >= field_max) {
+	field_max = (field_max) ? field_max * 2 : 16;
+	fields = (field *)realloc(fields, field_max * sizeof(field));
+    }
+    fp = &fields[field_cnt++];
+    fp->sym = k;
+    fp->size = getsize_LOC(getloc_SYM(k));
+    fp->align = get_alignoftype(gettype_SYM(k));
+    fp->uses = 0;
+}
+
+/* fields are declared in symbol order too */
+static field *find_field(int k) {
+    int lo = 0, hi = field_cnt-1;
+    while (lo <= hi) {
+	int mid = (lo + hi) / 2;
+	if (fields[mid].sym == k) return &fields[mid];
+	if (fields[mid].sym < k) lo = mid+1;
+	else hi = mid-1;
+    }
+    return 0;
+}
+
+/* visit every nVAR or nVREF under a, in any order */
+static void each_var(AST a, void (*visit)(AST)) {
+    AST s[4];
+    int i, kind;
+
+    stack_cnt = 0;
+    push(a, 0);
+    while (stack_cnt > 0) {
+	a = stack[--stack_cnt].a;
+	kind = nodetype(a);
+	if (kind < nPROG || kind >= nEND) continue;
+	if (kind == nVAR || kind == nVREF) visit(a);
+	get_sons(a, &s[0], &s[1], &s[2], &s[3]);
+	for (i=3;i>=0;i--)
+	    if (s[i]) push(s[i], 0);
+    }
+}
+
+static void visit_decl(AST a) {
+    int k = get_ival(a);
+    if (nodetype(a) == nVAR && k && getprop_SYM(k) == vLOCAL) add_field(k);
+}
+
+static void visit_use(AST a) {
+    field *fp;
+    if (nodetype(a) == nVREF && (fp = find_field(get_ival(a)))) fp->uses++;
+}
+
+static int by_layout(const void *p1, const void *p2) {
+    const field *f1 = p1, *f2 = p2;
+    if (f1->align != f2->align) return f2->align - f1->align;
+    if (f1->uses != f2->uses) return f2->uses - f1->uses;
+    return f1->sym - f2->sym;
+}
+
+/* lay out the fields in vdl of record type ty; funcs are its methods */
+int layout_record(AST ty, AST vdl, AST funcs) {
+    int i, off = 0, al = 1;
+
+    field_cnt = 0;
+    if (vdl) each_var(vdl, visit_decl);
+    if (field_cnt == 0) {	/* fields may still be NULL */
+	set_recordtype(ty, 0, 1);
+	return 0;
+    }
+    if (funcs) each_var(funcs, visit_use);
+    qsort(fields, field_cnt, sizeof(field), by_layout);
+
+    for (i=0;i<field_cnt;i++) {
+	field *fp = &fields[i];
+	int depth = getdepth_SYM(fp->sym);
+	int e;
+
+	off = align(off, fp->align);
+	e = lookup_loc_entry(depth, off, fp->size);
+	set_loc_entry(e, depth, off, fp->size);
+	setloc_SYM(fp->sym, e);
+	off += fp->size;
+	if (fp->align > al) al = fp->align;
+    }
+    off = align(off, al);
+    set_recordtype(ty, off, al);
+    return off;
+}
@@ -0,0 +1,8 @@
+#ifndef _FRAME_H_
+#define _FRAME_H_
+#include "ast.h"
+
+int layout_frame(AST);
+int layout_record(AST, AST, AST);
+
+#endif
@@ -1,86 +1,173 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <strings.h>
 
 #include "loc.h"
 
-static locentry *loctab;
-static int loccnt;
+/* the table and the offsets of one context, see context.c */
+struct LOC_state {
+    locentry *loctab;
+    int loccnt;
+    int locmax;
+    /* (depth, offset, size) -> entries, chained through locnext (-1: not hashed) */
+    int *lochash;
+    int lochsize;
+    int *locnext;
+    int var_offset;
+    int arg_offset;
+};
 
-static int var_offset = 0;
-static int arg_offset = -4;
+static LOC_state main_state = { 0, 0, 0, 0, 0, 0, 0, -4 };
+static __thread LOC_state *st = &main_state;
+
+LOC_state *new_LOC_state() {
+    LOC_state *s = (LOC_state *)calloc(1, sizeof(LOC_state));
+    s->arg_offset = -4;
+    return s;
+}
+
+void use_LOC(LOC_state *s) { st = (s) ? s : &main_state; }
+LOC_state *cur_LOC()       { return st; }
+
+void free_LOC(LOC_state *s) {
+    free(s->loctab);
+    free(s->lochash);
+    free(s->locnext);
+    if (s != &main_state) free(s);
+}
+static void rehash_LOC(int);
 
 void init_LOC() {
     int l;
-    loctab = (locentry*)malloc(l = MAX_LOC * sizeof(locentry));
-    bzero(loctab, l);
-    loccnt = 0;
+    st->locmax = MAX_LOC;
+    st->loctab = (locentry*)malloc(l = st->locmax * sizeof(locentry));
+    bzero(st->loctab, l);
+    st->locnext = (int *)malloc(l = st->locmax * sizeof(int));
+    memset(st->locnext, -1, l);
+    st->loccnt = 0;
+    rehash_LOC(MAX_LOC);
+}
+
+/* make room for entry e */
+static void grow_LOC(int e) {
+    int old = st->locmax;
+    if (e < st->locmax) return;
+    while (e >= st->locmax) st->locmax *= 2;
+    st->loctab = (locentry *)realloc(st->loctab, st->locmax * sizeof(locentry));
+    bzero(&st->loctab[old], (st->locmax - old) * sizeof(locentry));
+    st->locnext = (int *)realloc(st->locnext, st->locmax * sizeof(int));
+    memset(&st->locnext[old], -1, (st->locmax - old) * sizeof(int));
+}
+
+static unsigned loc_key(int dep, int off, int size) {
+    unsigned h = 2166136261u;
+    h = (h ^ dep) * 16777619u;
+    h = (h ^ off) * 16777619u;
+    h = (h ^ size) * 16777619u;
+    return h ^ (h >> 15);
+}
+
+static int *loc_bucket(locentry *ep) {
+    return &st->lochash[loc_key(ep->depth, ep->offset, ep->size) & (st->lochsize-1)];
+}
+
+static void link_loc(int e) {
+    int *bp = loc_bucket(&st->loctab[e]);
+    st->locnext[e] = *bp;
+    *bp = e;
+}
+
+static void unlink_loc(int e) {
+    int *bp;
+    if (st->locnext[e] < 0) return;
+    for (bp = loc_bucket(&st->loctab[e]); *bp != e; bp = &st->locnext[*bp])
+	;
+    *bp = st->locnext[e];
+    st->locnext[e] = -1;
+}
+
+/* rebuild the index with at least n buckets */
+static void rehash_LOC(int n) {
+    int e;
+    for (st->lochsize = 64; st->lochsize < n; st->lochsize *= 2)
+	;
+    free(st->lochash);
+    st->lochash = (int *)calloc(st->lochsize, sizeof(int));
+    for (e=1;e<=st->loccnt;e++)
+	if (st->locnext[e] >= 0) link_loc(e);
 }
 
 int new_loc() {
-    return ++loccnt;
+    grow_LOC(st->loccnt+1);
+    return ++st->loccnt;
 }
 
 void set_loc_entry(int e, int dep, int off, int size) {
     locentry *ep;
     if (e==0) return;
-    ep = &loctab[e];
+    unlink_loc(e);
+    ep = &st->loctab[e];
     ep->depth = dep;
     ep->offset = off;
     ep->size = size;
+    if (st->loccnt > st->lochsize) rehash_LOC(st->loccnt * 2);
+    link_loc(e);
 }
 
 void get_loc_entry(int e, int *dep, int *off, int *size) {
     locentry *ep;
     if (e==0) return;
-    ep = &loctab[e];
+    ep = &st->loctab[e];
     if (dep) *dep = ep->depth;
     if (off) *off = ep->offset;
     if (size) *size = ep->size;
 }
 
+/* the first entry with the same location, or a fresh one */
 int lookup_loc_entry(int dep, int off, int size) {
-    int e;
-    for (e=1;e<=loccnt;e++) {
-        locentry *ep = &loctab[e];
-        if (ep->depth == dep && ep->offset == off && ep->size == size)
-            return e;
+    int e, found = 0;
+    for (e = st->lochash[loc_key(dep, off, size) & (st->lochsize-1)]; e; e = st->locnext[e]) {
+        locentry *ep = &st->loctab[e];
+        if (ep->depth == dep && ep->offset == off && ep->size == size
+		&& (found == 0 || e < found))
+            found = e;
     }
-    return new_loc();
+    return (found) ? found : new_loc();
 }
 
 int getdepth_LOC(int e) {
     locentry *ep;
     if (e==0) return 0;
-    ep = &loctab[e];
+    ep = &st->loctab[e];
     return ep->depth;
 }
 
 int getoffset_LOC(int e) {
     locentry *ep;
     if (e==0) return 0;
-    ep = &loctab[e];
+    ep = &st->loctab[e];
     return ep->offset;
 }
 
 int getsize_LOC(int e) {
     locentry *ep;
     if (e==0) return 0;
-    ep = &loctab[e];
+    ep = &st->loctab[e];
     return ep->size;
 }
 
-inline int  get_var_offset()        { return var_offset; }
-inline int  get_arg_offset()        { return arg_offset; }
-inline void reset_offset()          { var_offset = 0; arg_offset = -4;}
-inline void incr_var_offset(int sz) { var_offset += sz;  }
-inline void decr_arg_offset(int sz) { arg_offset -= sz;  }
+inline int  get_var_offset()        { return st->var_offset; }
+inline int  get_arg_offset()        { return st->arg_offset; }
+inline void reset_offset()          { st->var_offset = 0; st->arg_offset = -4;}
+inline void incr_var_offset(int sz) { st->var_offset += sz;  }
+inline void decr_arg_offset(int sz) { st->arg_offset -= sz;  }
 
 void dump_LOC(FILE *fp) {
     int i;
-    locentry *ep = &loctab[1];
-    fprintf(fp, "LOC:cnt=%d\n", loccnt);
-    for (i=1;i<=loccnt;i++, ep++) {
+    locentry *ep = &st->loctab[1];
+    fprintf(fp, "LOC:cnt=%d\n", st->loccnt);
+    for (i=1;i<=st->loccnt;i++, ep++) {
          fprintf(fp, "%4d: %4d %4d %4d\n", i, 
                 ep->depth, ep->offset, ep->size);
     }
@@ -90,10 +177,13 @@ void dump_LOC(FILE *fp) {
 int restore_LOC(FILE *fp) {
     int i,k;
     locentry *ep;
-    fscanf(fp, "\nLOC:cnt=%d\n", &loccnt);
-    for (i=1;i<=loccnt;i++) {
-         ep = &loctab[i];
+    fscanf(fp, "\nLOC:cnt=%d\n", &st->loccnt);
+    grow_LOC(st->loccnt);
+    for (i=1;i<=st->loccnt;i++) {
+         ep = &st->loctab[i];
          fscanf(fp, "%4d: %4d %4d %4d\n", &k, 
                 &(ep->depth), &(ep->offset), &(ep->size));
+         st->locnext[i] = 0;
     }
+    rehash_LOC(st->loccnt * 2);
 }
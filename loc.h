@@ -1,7 +1,7 @@
 #ifndef _LOC_H_
 #define _LOC_H_
 
-#define MAX_LOC 1000
+#define MAX_LOC 1000	/* initial size, loctab grows on demand */
 
 typedef struct locentry {
     int depth;
@@ -9,6 +9,13 @@ typedef struct locentry {
     int size;
 } locentry;
 
+/* the table of one context, see context.h */
+typedef struct LOC_state LOC_state;
+LOC_state *new_LOC_state(void);
+void use_LOC(LOC_state *);
+LOC_state *cur_LOC(void);
+void free_LOC(LOC_state *);
+
 void init_LOC();
 int new_loc();
 void set_loc_entry(int e, int d, int o, int s);
@@ -19,6 +26,12 @@ int getdepth_LOC(int e);
 int getoffset_LOC(int e);
 int getsize_LOC(int e);
 
+int  get_var_offset(void);
+int  get_arg_offset(void);
+void reset_offset(void);
+void incr_var_offset(int);
+void decr_arg_offset(int);
+
 void dump_LOC(FILE*);
 int  restore_LOC(FILE*);
 
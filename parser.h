@@ -0,0 +1,63 @@
+#ifndef _PARSER_H_
+#define _PARSER_H_
+#include "token.h"
+#include "ast.h"
+#include "context.h"
+
+/* a function body left out by a skeleton, see parse_body() */
+typedef struct lazybody {
+    AST func;		/* nFUNCDECL without its block */
+    int ctx;		/* innermost class around it */
+    int no, pos;	/* the '{' */
+    int end_no, end_pos;	/* past the '}' */
+} lazybody;
+
+/* the type names a class declares, needed again by its bodies */
+typedef struct classctx {
+    AST sdl;		/* structs */
+    AST cdl;		/* inner classes */
+    int outer;		/* enclosing class, or -1 */
+} classctx;
+
+/* where a class or a method was read, see reparse() */
+typedef struct memberspan {
+    AST decl;		/* nCLASSDECL or nFUNCDECL */
+    int ctx;		/* class around it, -1 for a class */
+    int sym, sym_end;	/* the symbols made while reading it */
+    int before_no;	/* line of the token before */
+    int no, pos;	/* its first token */
+    int last_no;	/* line of its last token */
+    int after_no, after_pos;	/* the token after */
+} memberspan;
+
+/* one parse : its tables and what it has built */
+typedef struct Parser Parser;
+struct Parser {
+    Context *cx;
+    Token *t;		/* current token of cx */
+    AST  root;
+    AST  zero;		/* stands in for a bad expression */
+    int  debug;
+    AST  (*lval)(Parser *);	/* the leaves of an expression */
+    AST  (*con)(Parser *);
+    bool skeleton;	/* leave the function bodies out */
+    lazybody *lazy;
+    int  lazy_cnt, lazy_max;
+    classctx *ctxs;
+    int  ctx_cnt, ctx_max;
+    int  cur_ctx;
+    memberspan *spans;
+    int  span_cnt, span_max;
+    int  blocks;	/* open while reading a body */
+};
+
+AST parse_expr(Parser *);
+
+/* parser2 : signatures first, bodies on demand */
+Parser *start_skeleton(Context *);
+AST  parse_body(Parser *, AST);
+void parse_bodies(Parser *, int);
+AST  reparse(Parser *, int, int, char *);
+void free_parser(Parser *);
+
+#endif
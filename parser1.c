@@ -9,6 +9,9 @@
 #include "token.h"
 #include "sym.h"
 #include "ast.h"
+#include "frame.h"
+#include "parser.h"
+#include "sema.h"
 
 /*
    Grammar 
@@ -37,7 +40,7 @@ primtype  ::= INT | CHAR | FLOAT | STRING
 block     ::= '{' vardecls stmts '}'
 stmts     ::= [ stmt ]*
 stmt      ::= expr ';' | ifstmt | asnstmt | block
-ifstmt    ::= IF '(' bexpr ')' stmt ELSE stmt  // dangling else
+ifstmt    ::= IF '(' expr ')' stmt ELSE stmt  // dangling else
 
 // here is not LL(1)
 asnstmt   ::= lval asnop expr
@@ -48,68 +51,83 @@ argrefs   ::= argref { ',' argref }*
 argref    ::= expr
 lval	     ::= vref exprs?
 exprs     ::= { '[' expr ']' }*
-expr      ::= term   [ '+' term ]* 
-term      ::= factor [ '*' factor ]*
-factor    ::= lval | con | '(' expr ')' | mesexpr
-bexpr     ::= TRUE | FALSE | expr relop expr
+expr      ::= unary [ binop unary ]*	// see expr.c
 asnop     ::= '=' | PLUSEQ | MINUSEQ | STAREQ | SLASHEQ | ...
-relop     ::= EQEQ | NOTEQ | GT | GTEQ | LT | LTEQ
 vref      ::= ID
 con       ::= LIT
  */
 
 extern Token *gettoken();
-extern void skiptoken(int);
-extern void skiptoken2(int,int);
-extern void skiptoken3(int,int,int);
 
-static AST block(bool);
+/* FIRST(stmt) and FOLLOW(stmt) less ID : where a bad stmt is left */
+static const int stmt_sync[] = { ';', '{', tIF, tWHILE, tBREAK, tCONTINUE, tELSE, 0 };
+
+/* the same for a vardecl : FIRST(vardecl) and FIRST(stmt) less ID */
+static const int vardecl_sync[] = {
+    ';', tINT, tCHAR, tFLOAT, tSTRING, '{', tIF, tWHILE, tBREAK, tCONTINUE, 0
+};
+
+static AST block(Parser *, bool);
 static bool isprimtype(int k);
-static AST vardecls(AST vdl, AST fdl);
-static AST vardecl(void);
-static AST typedecl(void);
-static AST mod(AST);
-static AST primtype(void);
-static AST argdecllist(void);
-static AST argdecl(void);
-static AST vars(AST);
-static AST var(AST);
-static AST lval(void);
-static AST vref(void);
-static AST name(void);
-static AST con(void);
-static AST stmts(bool isWhile);
-static AST stmt(bool);
-static AST asnstmt(void);
-static AST ifstmt(void);
-static AST whilestmt(void);
-static AST exprs(void);
-static AST expr(void);
-static AST bexpr(void);
-static AST bexpr_sub(void);
-static AST term(void);
-static AST factor(void);
-
-static AST ast_root;
-static AST zero;
-
-static int ast_debug = false;
+static AST vardecls(Parser *, AST vdl, AST fdl);
+static AST vardecl(Parser *);
+static AST typedecl(Parser *);
+static AST mod(Parser *, AST);
+static AST primtype(Parser *);
+static AST argdecllist(Parser *);
+static AST argdecl(Parser *);
+static AST vars(Parser *, AST);
+static AST var(Parser *, AST);
+static AST lval(Parser *);
+static AST vref(Parser *);
+static AST name(Parser *);
+static AST con(Parser *);
+static AST stmts(Parser *, bool isWhile);
+static AST stmt(Parser *, bool);
+static void skip_stmt(Parser *);
+static AST asnstmt(Parser *);
+static AST ifstmt(Parser *);
+static AST whilestmt(Parser *);
+static AST exprs(Parser *);
+
+static void init_parser(Parser *p, Context *cx) {
+    memset(p, 0, sizeof(Parser));
+    p->cx = cx;
+    p->t = cur_token();
+    p->zero = make_AST_con("0",0);
+    p->lval = lval;
+    p->con = con;
+}
 
 #ifdef TEST_PARSER
-int main() {
-    initline();
-    init_AST();
-    init_SYM();
-    init_LOC();
-
-    zero = make_AST_con("0",0);
+int main(int argc, char *argv[]) {
+    Parser ps, *p = &ps;
+    int i;
+
+    init_parser(p, new_context(stdin));
+
+    /*
+       -s : check in a separate pass, -jN : with N threads
+       -mN : at most N diagnostics, 0 for all of them
+     */
+    for (i=1;i<argc;i++) {
+	if (strcmp(argv[i], "-s") == 0) defer_checks(true);
+	if (strncmp(argv[i], "-m", 2) == 0) set_error_limit(atoi(argv[i]+2));
+	if (strncmp(argv[i], "-j", 2) == 0) {
+	    defer_checks(true);
+	    threads_SEMA(atoi(argv[i]+2));
+	}
+    }
     gettoken();
-    ast_root = block(false);  /* inside the block */
+    p->root = block(p, false);  /* inside the block */
+    if (checks_deferred()) check_SEMA(p->root);
+    else layout_frame(p->root);
 
-    print_AST(ast_root);
+    freeze_AST(p->root);
+    print_frozen_AST();
     printf("\n\n");
 
-    if (ast_debug) {
+    if (p->debug) {
 	dump_AST(stdout);
 	printf("\n");
     }
@@ -122,18 +140,25 @@ int main() {
     printf("\n");
     dump_STR(stdout);
 
+    free_context(p->cx);
     return 0;
 }
 #else
-int start_parser() {
-    zero = make_AST_con("0",0);
+/* parse a block from the source of cx, on the calling thread */
+AST start_parser(Context *cx) {
+    Parser ps, *p = &ps;
+
+    use_context(cx);
+    init_parser(p, cx);
     gettoken();
-    return block(false); 
+    p->root = block(p, false);
+    layout_frame(p->root);
+    return p->root;
 }
 #endif
 
-static AST block(bool isWhile) {
-    Token *t = &tok;
+static AST block(Parser *p, bool isWhile) {
+    Token *t = p->t;
     AST a=0;
     AST vdl,fdl,sts;
 
@@ -143,9 +168,9 @@ static AST block(bool isWhile) {
 
 	vdl = new_list(nVARDECLS);
 	fdl = new_list(nFUNCDECLS);  /* ignored */
-	vardecls(vdl,fdl);
+	vardecls(p, vdl,fdl);
 
-	sts = stmts(isWhile);
+	sts = stmts(p, isWhile);
 
 	if (t->sym == '}') {
 	    gettoken();
@@ -164,8 +189,8 @@ inline static bool isprimtype(int k) {
     return (k==tINT || k==tCHAR || k==tFLOAT || k==tSTRING);
 }
 
-static AST vardecls(AST vdl, AST fdl) {
-    Token *t = &tok;
+static AST vardecls(Parser *p, AST vdl, AST fdl) {
+    Token *t = p->t;
     AST a=0;
     AST a1=0;
 
@@ -173,22 +198,26 @@ static AST vardecls(AST vdl, AST fdl) {
 
     while (true) {
 	if (! isprimtype(t->sym) ) break;
-	a1 = vardecl();
+	a1 = vardecl(p);
 	if (a1) vdl = append_list(vdl, a1);
 
 	if (t->sym == ';') gettoken();
-	else parse_error("expected ;");
+	else {
+	    parse_error("expected ;");
+	    if (errors_over_limit()) break;
+	    if (skipto(vardecl_sync) == ';') gettoken();
+	}
     }
     return vdl;
 }
 
-static AST vardecl() {
-    Token *t = &tok;
+static AST vardecl(Parser *p) {
+    Token *t = p->t;
     AST a=0;
     AST a1=0,a2=0,a3=0,a4=0;
 
-    a2 = typedecl();
-    a1 = vars(a2);	/* TODO: change var() to vars() */
+    a2 = typedecl(p);
+    a1 = vars(p, a2);	/* TODO: change var() to vars() */
 
     if (t->sym == ';') { /* vardecl */
 	a = make_AST_vardecl(a1, a2, 0, 0);
@@ -198,16 +227,16 @@ static AST vardecl() {
     return a;
 }
 
-static AST typedecl() {
-    Token *t = &tok;
+static AST typedecl(Parser *p) {
+    Token *t = p->t;
     AST a=0;
-    a = primtype();
-    a = mod(a);
+    a = primtype(p);
+    a = mod(p, a);
     return a;
 }
 
-static AST mod(AST elem) {
-    Token *t = &tok;
+static AST mod(Parser *p, AST elem) {
+    Token *t = p->t;
     AST a,a1=0;
     int sz;
 
@@ -226,13 +255,13 @@ static AST mod(AST elem) {
 	else parse_error("expected ]");
 
 	a = array_type(gen(tGLOBAL), elem, sz);
-	a = mod(a);
+	a = mod(p, a);
     }
     return a;
 }
 
-static AST primtype() {
-    Token *t = &tok;
+static AST primtype(Parser *p) {
+    Token *t = p->t;
     AST a=0;
 
     switch (t->sym) {
@@ -246,30 +275,25 @@ static AST primtype() {
     return a;
 }
 
-static AST vars(AST type) {
-    Token *t = &tok;
+static AST vars(Parser *p, AST type) {
+    Token *t = p->t;
     AST a=0;
     AST a1=0;
 
     a = new_list(nVARS);
-    a1= var(type);
+    a1= var(p, type);
     if (a1) a = append_list(a,a1);
 
-    while (true) {
-	if (t->sym == ';')
-	    break;
-
-	if (t->sym == ',') gettoken();
-	else parse_error("expected ,");
-
-	a1 = var(type);
+    while (t->sym == ',') {	/* vardecl() tells what else is wrong */
+	gettoken();
+	a1 = var(p, type);
 	if (a1) a = append_list(a,a1);
     }
     return a;
 }
 
-static AST var(AST type) {
-    Token *t = &tok;
+static AST var(Parser *p, AST type) {
+    Token *t = p->t;
     int idx;
     AST a=0;
 
@@ -285,8 +309,8 @@ static AST var(AST type) {
     return a;
 }
 
-static AST name() {
-    Token *t = &tok;
+static AST name(Parser *p) {
+    Token *t = p->t;
     AST a=0;
 
     if (t->sym == ID) {
@@ -299,16 +323,16 @@ static AST name() {
     return a;
 }
 
-static AST vref()  {
-    Token *t = &tok;
+static AST vref(Parser *p)  {
+    Token *t = p->t;
     int idx=0;
     AST a=0;
 
     if (t->sym == ID) {
 	char *s = strdup(t->text);
 	gettoken();
-	idx = lookup_SYM_all(s);
-	if (idx == 0) parse_error("Undefined variable");
+	if (checks_deferred()) idx = 0;	/* resolved by sema */
+	else if ((idx = lookup_SYM_all(s)) == 0) parse_error("Undefined variable");
 	a = make_AST_vref(s,idx);
     } else {
 	parse_error("expected ID");
@@ -316,32 +340,20 @@ static AST vref()  {
     return a;
 }
 
-static AST con() {
-    Token *t = &tok;
-    int v;
+static AST con(Parser *p) {
+    Token *t = p->t;
     int idx;
-    char *p;
-    char *s;
     AST ty=0;
     AST a=0;
 
-    v = t->ival;
-    p = gen(cLOCAL);
-    s = insert_STR(t->text);
-
-    if (t->sym >= ILIT && t->sym <= SLIT)
-	ty = (t->sym - ILIT) +1;
+    ty = littype_AST(t->sym);
 
     switch (t->sym) {
 	case ILIT: case CLIT: /* int, char */
-	    gettoken();
-	    idx = insert_SYM(p, 0, cLOCAL, v); /* immediate */
-	    a = make_AST_con(p,idx);
-	    break;
 	case FLIT: case SLIT: /* float, string */
+	    idx = insert_CON(ty, t->ival, t->text);
 	    gettoken();
-	    idx = insert_SYM(p, ty, cLOCAL, get_STR_offset(s));
-	    a = make_AST_con(p,idx);
+	    a = make_AST_con(0,idx);
 	    break;
 	default:
 	    parse_error("expected LIT");
@@ -352,8 +364,8 @@ static AST con() {
     return a;
 }
 
-static AST stmts(bool isWhile) {
-    Token *t = &tok;
+static AST stmts(Parser *p, bool isWhile) {
+    Token *t = p->t;
     AST a=0;
     AST a1=0, a2=0 ;
 
@@ -362,28 +374,36 @@ static AST stmts(bool isWhile) {
 	if (t->sym != ID && t->sym != tIF && t->sym != '{' && t->sym != tWHILE && t->sym != tBREAK && t->sym != tCONTINUE) 
 	    break;
 
-	a1 = stmt(isWhile);
+	a1 = stmt(p, isWhile);
 	a = append_list(a, a1);
     }
     return a;
 }
 
-static AST stmt(bool isWhile) {
-    Token *t = &tok;
+/* after an error : go on from the next stmt, an ID may begin it */
+static void skip_stmt(Parser *p) {
+    if (p->t->sym != ID && skipto(stmt_sync) == ';') gettoken();
+}
+
+static AST stmt(Parser *p, bool isWhile) {
+    Token *t = p->t;
     AST a=0;
     AST a1=0;
 
     switch (t->sym) {
 	case ID: /* TODO: extend to support call */
-	    a1 = asnstmt();
+	    a1 = asnstmt(p);
 	    if (t->sym == ';') gettoken();
-	    else parse_error("expected ;");
+	    else {
+		parse_error("expected ;");
+		skip_stmt(p);
+	    }
 	    break;
 	case tIF:
-	    a1 = ifstmt();
+	    a1 = ifstmt(p);
 	    break;
 	case tWHILE:
-	    a1 = whilestmt();
+	    a1 = whilestmt(p);
 	    break;
 	case tBREAK:
 	    gettoken();
@@ -406,12 +426,12 @@ static AST stmt(bool isWhile) {
 	    else parse_error("expected ;");
 	    break;
 	case '{': 
-	    a1 = block(isWhile);
+	    a1 = block(p, isWhile);
 	    break;
 
 	default:
 	    parse_error("expected ID, IF or block");
-	    skiptoken(';');
+	    skip_stmt(p);
 	    break;
     }
     /*a = make_AST(nSTMT, a1, 0, 0, 0);*/
@@ -419,14 +439,14 @@ static AST stmt(bool isWhile) {
     return a1;
 }
 
-static AST asnstmt() {
-    Token *t = &tok;
+static AST asnstmt(Parser *p) {
+    Token *t = p->t;
     int ival;
     AST a=0;
     AST a1=0, a2=0;
     int op;
 
-    a1 = expr();
+    a1 = parse_expr(p);
     switch (t->sym) {
 	case ASNOP:
 	    if (nodetype(a1) == nLVAL || nodetype(a1) == nVREF) {
@@ -442,14 +462,14 @@ static AST asnstmt() {
 	    break;
     }
 
-    a2 = expr();
-    if (!equaltype(a1, a2)) parse_error("Type missmatched");
+    a2 = parse_expr(p);
+    if (!checks_deferred() && !equaltype(a1, a2)) parse_error("Type missmatched");
     a = make_AST_asn(op, a1, a2);
     return a;
 }
 
-static AST ifstmt() {
-    Token *t = &tok;
+static AST ifstmt(Parser *p) {
+    Token *t = p->t;
     AST a=0;
     AST a1=0,a2=0,a3=0;
 
@@ -457,15 +477,15 @@ static AST ifstmt() {
 	gettoken();
 	if (t->sym == '(') {
 	    gettoken();
-	    a1 = bexpr(); 
+	    a1 = parse_expr(p); 
 
 	    if (t->sym == ')') gettoken();
 	    else parse_error("expected )");
 
-	    a2 = stmt(false);
+	    a2 = stmt(p, false);
 	    if (t->sym == tELSE) {   /* else is optional */
 		gettoken();
-		a3 = stmt(false);
+		a3 = stmt(p, false);
 	    } 
 
 	} else {
@@ -474,13 +494,13 @@ static AST ifstmt() {
 	a = make_AST_if(a1,a2,a3);
     } else {
 	parse_error("expected if");
-	skiptoken(';');
+	skip_stmt(p);
     }
     return a;
 }
 
-static AST whilestmt() {
-    Token *t = &tok;
+static AST whilestmt(Parser *p) {
+    Token *t = p->t;
     AST a=0;
     AST a1=0,a2=0;
 
@@ -488,48 +508,48 @@ static AST whilestmt() {
 	gettoken();
 	if (t->sym == '(') {
 	    gettoken();
-	    a1 = bexpr(); 
+	    a1 = parse_expr(p); 
 
 	    if (t->sym == ')') gettoken();
 	    else parse_error("expected )");
 
-	    a2 = stmt(true);
+	    a2 = stmt(p, true);
 	} else {
 	    parse_error("expected (");
 	}
 	a = make_AST_while(a1,a2);
     } else {
 	parse_error("expected while");
-	skiptoken(';');
+	skip_stmt(p);
     }
     return a;
 }
-static AST lval() {
-    Token *t = &tok;
+static AST lval(Parser *p) {
+    Token *t = p->t;
     AST a=0;
     AST a1=0,a2=0;
 
-    a1 = vref();
+    a1 = vref(p);
 
     if (t->sym == '[') {
-	a2 = exprs();
+	a2 = exprs(p);
 	a = make_AST(nLVAL, a1, a2, 0, 0);
     } else
 	a = a1;
     return a;
 }
 
-static AST exprs() {
-    Token *t = &tok;
+static AST exprs(Parser *p) {
+    Token *t = p->t;
     AST a,a1=0;
 
     a = new_list(nEXPRS);
     while (true) {
 	if (t->sym != '[') break;
 	gettoken();
-	a1 = expr();
+	a1 = parse_expr(p);
 	//check type of index: it must be integer:
-	if (typeof_AST(a1) != make_AST_name("int")) parse_error("Index of array must be integer");
+	if (!checks_deferred() && typeof_AST(a1) != make_AST_name("int")) parse_error("Index of array must be integer");
 	if (a1) a = append_list(a,a1);
 
 	if (t->sym == ']') gettoken();
@@ -538,214 +558,3 @@ static AST exprs() {
     return a;
 }
 
-static AST expr() {
-    Token *t = &tok;
-    AST a=0;
-    AST a1=0, a2=0;
-    int op;
-
-    /* when missing both ID/LIT and ; FOLLOW(stmt) may appear */
-    if (t->sym == tIF || t->sym == tELSE) {
-	return zero;
-    }
-
-    a = term();
-
-    /* FOLLOW(term) = { ';', ',', ')' ,']' } */
-    while (true) {
-	if (t->sym == ';' || t->sym == ',' || t->sym == ')' || t->sym == ']')
-	    break;
-	switch (t->sym) {
-	    case ASNOP: case RELOP: case LOGOP:
-		// this should be an assignment: 
-		return a;
-	    case ARIOP:
-		if (t->ival != '+' && t->ival != '-') {
-		    parse_error("expected + or -");
-		    skiptoken(';');
-		    return a;
-		}
-		op = t->ival;
-		gettoken();
-		break;
-	    case ILIT:
-		/* when LIT does not begin with +/-, it is missing */
-		if (t->text[0] != '+' && t->text[0] != '-')
-		    parse_error("expected + or -");
-		op = '+';
-		break;
-
-	    case ID: case tIF: case tELSE: /* FOLLOW(expr) when ; is missing */
-		parse_error("purhaps missing ;");
-		return a;
-
-	    default:
-		parse_error("exepected op"); 
-		skiptoken2(';',ARIOP);
-		return a;
-	}
-	a1 = a;
-	a2 = term();
-	a = make_AST_op2(op, a1, a2); /* left associative */
-    }
-    return a;
-}
-
-static AST term() {
-    Token *t = &tok;
-    AST a =0;
-    AST a1=0, a2=0;
-    int op;
-
-    a = factor();
-
-    /* FOLLOW(factor) = { ';', ',', ')' , ']', '+', '-' } */
-    while (true) {
-	if (t->sym == ';' || t->sym == ',' || t->sym == ')' || t->sym == ']')
-	    break;
-	if (t->sym == ILIT) /* a+1 => ID<a> ILIT<+1> , same as OP<+> */
-	    break;
-
-	switch (t->sym) {
-	    case ASNOP: case RELOP: case LOGOP:
-		return a;
-	    case DUPOP:
-		if (nodetype(a) == nLVAL || nodetype(a) == nVREF) return a; 
-	    case ARIOP:
-		if (t->ival == '+' || t->ival == '-')
-		    return a; 
-		if (t->ival != '*' && t->ival != '/') {
-		    parse_error("expected * or /");
-		    skiptoken(';');
-		    return a; 
-		}
-		op = t->ival;
-		gettoken();
-		break;
-
-	    case '(':
-		parse_error("purhaps missing * or /");
-		op = '*';
-		break;
-
-	    case ID: case tIF: case tELSE: /* FOLLOW(expr) when ; is missing */
-		parse_error("purhaps missing ;");
-		return a;
-
-	    default:
-		parse_error("expected op"); 
-		skiptoken2(';',ARIOP);
-		return a;
-	}
-	a1 = a;
-	a2 = factor();
-	a  = make_AST_op2(op, a1, a2); /* left associative */
-    }
-    return a;
-}
-
-/* returns 'zero' if parse_error occurs */
-static AST factor() {
-    Token *t = &tok;
-    AST a=0;
-    int op;
-
-    switch (t->sym) {
-	case DUPOP:
-	    op = t->ival;
-	    gettoken();
-	    a = lval();
-	    return make_AST_op1(op, a);
-	    break;
-	case ID :
-	    a = lval();
-	    if (t->sym == DUPOP) {
-		a = make_AST_op0(t->ival, a);
-		gettoken();
-		return a;
-	    }
-	    break;
-	case ILIT: case CLIT: case FLIT: case SLIT: 
-	    a = con();
-	    break;
-	case '(': 
-	    gettoken();
-	    a = expr();
-	    if (t->sym == ')') gettoken();
-	    else parse_error("expected )");
-	    break;
-	default: 
-	    parse_error("expected ID or LIT");
-	    skiptoken3(';',')',ARIOP);
-	    a = zero;
-	    break;
-    }
-    return a;
-}
-
-/* good */
-static AST bexpr() {
-    Token *t = &tok;
-    char *s = strdup(t->text);
-    AST a, a1;
-    a = bexpr_sub();
-    int op;
-    while (true){
-	switch (t->sym) {
-	    case ')':
-		return a;
-	    case LOGOP:
-		op = t->ival;
-		gettoken();
-		a1 = bexpr_sub();
-		a = make_AST_op2(op, a, a1);
-		break;
-	    default:
-		parse_error("Expected \')\' or a logical operator");
-		return 0;
-	}
-    }
-}
-
-static AST bexpr_sub() {
-    Token *t = &tok;
-    char *s = strdup(t->text);
-    AST a, a1;
-    int op;
-    switch (t->sym){
-	case tTRUE: 
-	    gettoken(); 
-	    return make_AST_con(s,1);
-	case tFALSE: 
-	    gettoken(); 
-	    return make_AST_con(s,0);
-	case '(':
-	    gettoken();
-	    a = bexpr();
-	    if (t->sym == ')'){
-		gettoken();
-	    } else {
-		parse_error(") expected");
-	    }
-	    return a;
-	case LOGOP:
-	    if (t->ival == '!'){
-		op = t->ival;
-		gettoken();
-		a = bexpr_sub();
-		a = make_AST_op1(op, a);
-		return a;
-	    }
-	default:
-	    a = expr();
-	    switch (t->sym){
-		case RELOP:
-		    op = t->ival;
-		    gettoken();
-		    a1 = expr();
-		    return make_AST_op2(op, a, a1);
-		default:
-		    return a;
-	    }
-    }
-}
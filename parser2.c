@@ -5,10 +5,16 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 #include "token.h"
+#include "loc.h"
 #include "sym.h"
 #include "type.h"
 #include "ast.h"
+#include "diff.h"
+#include "frame.h"
+#include "parser.h"
+#include "sema.h"
 
 /*
    Grammar 
@@ -20,7 +26,7 @@
    vardecls  ::= [ vardecl ]*
    funcdecls ::= [ funcdecl ]*
 
-// here is not LL(1)
+// here is not LL(1), told by peek()
 vardecl   ::= typedecl id ';'
 funcdecl  ::= typedecl id '(' argdecls ')' block
 // end
@@ -36,9 +42,9 @@ primtype  ;;= INT | CHAR | FLOAT | STRING
 block     ::= '{' vardecls stmts '}'
 stmts     ::= [ stmt ]*
 stmt      ::= expr ';' | ifstmt | asnstmt  | block
-ifstmt    ::= IF '(' bexpr ')' stmt ELSE stmt
+ifstmt    ::= IF '(' expr ')' stmt ELSE stmt
 
-// here is not LL(1)
+// here is not LL(1), told by peek()
 asnstmt   ::= lval '=' expr
 callstmt  ::= name '(' argrefs ')
 // end
@@ -47,79 +53,158 @@ argrefs   ::= argref { ',' argref }*
 argref    ::= expr
 lval	     ::= vref exprs?
 exprs     ::= { '[' expr ']' }*
-expr      ::= term   [ '+' term ]* 
-term      ::= factor [ '*' factor ]*
-factor    ::= lval | con | '(' expr ')' | mesexpr
-bexpr     ::= TRUE | FALSE | expr relop expr
-relop     ::= EQEQ | NOTEQ | GT | GTEQ | LT | LTEQ
+expr      ::= unary [ binop unary ]*	// see expr.c
 vref      ::= ID
 con       ::= LIT
  */
 
 extern Token *gettoken();
-extern void skiptoken(int);
-extern void skiptoken2(int,int);
-
-static AST program(void);
-static AST classdecls(void);
-static AST classdecl(void);
-static AST classhead(void);
-static AST structdecls(AST sdl);
-static AST vardecls(AST vdl, AST fdl);
-static AST funcdecls(AST fdl);
-static AST structdecl(void);
-static AST vardecl(void);
-static AST funcdecl(void);
-static AST typedecl(void);
-static AST retdecl(void);
-static AST mod(AST);
-static AST vartype(void);
-static AST rettype(void);
+
+/* FIRST(stmt) and FOLLOW(stmt) less ID : where a bad stmt is left */
+static const int stmt_sync[] = { ';', '{', tIF, tRETURN, tELSE, 0 };
+
+/*
+   the same for the lists of declarations and args.  a list goes on
+   only past a separator or from a token its rule takes, so every pass
+   reads a token; past the error limit it is left to the enclosing rule.
+   ID is left out, as above, and tCLASS as nested classes come first.
+ */
+static const int class_sync[]   = { tCLASS, 0 };
+static const int member_sync[]  = { ';', tINT, tCHAR, tFLOAT, tSTRING, tVOID, 0 };
+static const int decl_sync[]    = { ';', tINT, tCHAR, tFLOAT, tSTRING, tVOID, '{', tIF, tRETURN, 0 };
+static const int argdecl_sync[] = { ',', ')', '{', 0 };
+static const int argref_sync[]  = { ',', ')', ';', '{', tIF, tRETURN, tELSE, 0 };
+
+static AST program(Parser *);
+static AST classdecls(Parser *);
+static AST classdecl(Parser *);
+static AST classhead(Parser *);
+static AST structdecls(Parser *, AST sdl);
+static AST vardecls(Parser *, AST vdl);
+static AST funcdecls(Parser *, AST fdl);
+static AST structdecl(Parser *);
+static AST vardecl(Parser *);
+static AST funcdecl(Parser *);
+static AST typedecl(Parser *);
+static AST retdecl(Parser *);
+static AST mod(Parser *, AST);
+static AST vartype(Parser *);
+static AST rettype(Parser *);
 static bool isprimtype(int k);
-static bool isclasstype();
-static bool isstructtype();
+static bool isclasstype(Parser *);
+static bool isstructtype(Parser *);
 static bool isrettype(int k);
-static AST argdecls(void);
-static AST argdecl(void);
-static AST block(void);
-static AST stmts(void);
-static AST stmt(void);
-static AST asnstmt(AST);
-static AST ifstmt(void);
-static AST callstmt(AST);
-static AST returnstmt(void);
-static AST argrefs();
-static AST argref(void);
-static AST var(void);
-static AST name(void);
-static AST classname(void);
-static AST structname(void);
-static AST vName(void);
-static AST vref(void);
-static AST lval(void);
-static AST exprs(void);
-static AST con(void);
-static AST expr(void);
-static AST bexpr(void);
-
-static AST ast_root;
-
-static int ast_debug = false;
+static bool ismethod(Parser *);
+static AST argdecls(Parser *);
+static AST argdecl(Parser *);
+static AST block(Parser *);
+static int skip_body(Parser *);
+static int push_ctx(Parser *, AST);
+static void begin_span(Parser *, memberspan *);
+static void end_span(Parser *, memberspan *, AST);
+static AST stmts(Parser *);
+static AST stmt(Parser *);
+static void skip_stmt(Parser *);
+static void end_stmt(Parser *);
+static AST asnstmt(Parser *);
+static AST ifstmt(Parser *);
+static AST callstmt(Parser *, AST);
+static AST returnstmt(Parser *);
+static AST argrefs(Parser *);
+static AST argref(Parser *);
+static AST var(Parser *);
+static AST name(Parser *);
+static AST classname(Parser *);
+static AST structname(Parser *);
+static AST vName(Parser *);
+static AST vref(Parser *);
+static AST lval(Parser *);
+static AST exprs(Parser *);
+static AST con(Parser *);
+
+static void init_parser(Parser *p, Context *cx) {
+    memset(p, 0, sizeof(Parser));
+    p->cx = cx;
+    p->t = cur_token();
+    p->lval = lval;
+    p->con = con;
+    p->cur_ctx = -1;
+}
 
 #ifdef TEST_PARSER
-int main() {
-    initline();
-    init_AST();
-    init_SYM();
-    init_LOC();
+/*
+   -eFILE : the first line of FILE is "no cnt", the lines to put there
+   follow.  with check, the member read again is checked on its own.
+ */
+static void edit_source(Parser *p, char *path, bool check) {
+    AST a;
+    FILE *fp = fopen(path, "r");
+    char buf[MAX_LINE], *text;
+    int no, cnt, len;
+
+    if (fp == 0 || fgets(buf, MAX_LINE, fp) == 0 || sscanf(buf, "%d %d", &no, &cnt) != 2) {
+	printf("%s : no edit\n", path);
+	if (fp) fclose(fp);
+	return;
+    }
+    text = (char *)malloc(MAX_LINE);
+    text[0] = 0;
+    for (len = 0; fgets(text + len, MAX_LINE, fp); len += strlen(text + len))
+	text = (char *)realloc(text, len + 2 * MAX_LINE);
+    fclose(fp);
+    if ((a = reparse(p, no, cnt, text)) == 0)
+	printf("%s : not inside a class or method, read the whole source again\n", path);
+    else if (check)
+	check_member_SEMA(a);
+    free(text);
+}
 
+int main(int argc, char *argv[]) {
+    Parser ps, *p = &ps;
+    bool bodies = false, edits = false, index = false, check;
+    int i, jobs = 1;
+
+    init_parser(p, new_context(stdin));
+
+    /*
+       -s : check in a separate pass, -jN : with N threads
+       -k : signatures only, -l : the same with every body parsed after,
+       by N threads with -jN
+       -eFILE : then apply the edit in FILE, see edit_source()
+       -mN : at most N diagnostics a unit, 0 for all of them
+       -x : check the node index at the end
+     */
+    for (i=1;i<argc;i++) {
+	if (strcmp(argv[i], "-s") == 0) defer_checks(true);
+	if (strncmp(argv[i], "-j", 2) == 0) {
+	    defer_checks(true);
+	    threads_SEMA(jobs = atoi(argv[i]+2));
+	}
+	if (strcmp(argv[i], "-k") == 0 || strcmp(argv[i], "-l") == 0) {
+	    p->skeleton = true;
+	    bodies = (argv[i][1] == 'l');
+	}
+	if (strncmp(argv[i], "-e", 2) == 0) edits = true;
+	if (strncmp(argv[i], "-m", 2) == 0) set_error_limit(atoi(argv[i]+2));
+	if (strcmp(argv[i], "-x") == 0) index = true;
+    }
+    if (p->skeleton || edits) {
+	defer_checks(true);
+	keep_input(true);
+    }
     gettoken();
-    ast_root = program();
-
-    print_AST(ast_root);
+    p->root = program(p);
+    if (bodies) parse_bodies(p, jobs);
+    check = checks_deferred() && (bodies || !p->skeleton);
+    if (check) check_SEMA(p->root);
+    for (i=1;i<argc;i++)
+	if (strncmp(argv[i], "-e", 2) == 0) edit_source(p, argv[i]+2, check);
+
+    freeze_AST(p->root);
+    print_frozen_AST();
     printf("\n\n");
 
-    if (ast_debug) {
+    if (p->debug) {
 	dump_AST(stdout);
 	printf("\n");
     }
@@ -131,51 +216,95 @@ int main() {
 
     printf("\n");
     dump_STR(stdout);
+
+    printf("\n");
+    dump_SIG(stdout, p->root);
+    if (index && check_index_AST(stdout) == 0) printf("INDEX: ok\n");
+    free(p->lazy);
+    free(p->ctxs);
+    free(p->spans);
+    free_context(p->cx);
     return 0;
 }
 #else
-int start_parser() {
+/* parse a program from the source of cx, on the calling thread */
+AST start_parser(Context *cx) {
+    Parser ps, *p = &ps;
+
+    use_context(cx);
+    init_parser(p, cx);
     gettoken();
-    return program();
+    p->root = program(p);
+    return p->root;
+}
+
+/* parse the classes and signatures only; see parse_body() */
+Parser *start_skeleton(Context *cx) {
+    Parser *p = (Parser *)malloc(sizeof(Parser));
+
+    use_context(cx);
+    init_parser(p, cx);
+    p->skeleton = true;
+    defer_checks(true);
+    keep_input(true);
+    gettoken();
+    p->root = program(p);
+    return p;
+}
+
+void free_parser(Parser *p) {
+    free(p->lazy);
+    free(p->ctxs);
+    free(p->spans);
+    free(p);
 }
 #endif
 
-static AST program() {
-    Token *t = &tok;
+static AST program(Parser *p) {
+    Token *t = p->t;
     AST a=0;
     AST a1=0, a2=0;
 
-    a1 = classdecls();
+    a1 = classdecls(p);
+    while (t->sym != tEND && !errors_over_limit()) {
+	parse_error("expected class");
+	while (skipto(class_sync) == '}') gettoken();
+	while (t->sym == tCLASS)
+	    if ((a2 = classdecl(p)) != 0) a1 = append_list(a1, a2);
+    }
     a = make_AST(nPROG, a1, 0, 0, 0);
     return a;
 }
 
-static AST classdecls() {
-    Token *t = &tok;
+static AST classdecls(Parser *p) {
+    Token *t = p->t;
     AST a=0;
     AST a1=0, a2=0;
 
     /* at least one class is required */
     a = new_list(nCLASSDECLS);
-    a1 = classdecl();
+    a1 = classdecl(p);
     if (a1) a = append_list(a, a1);
 
     while (true) {
 	if (t->sym != tCLASS) break;
 
-	a1 = classdecl();
+	a1 = classdecl(p);
 	if (a1) a = append_list(a, a1);
     }
     return a;
 }
 
-static AST classdecl() {
-    Token *t = &tok;
+static AST classdecl(Parser *p) {
+    Token *t = p->t;
     AST a=0;
     AST a1=0, a2=0, a3=0, a4 = 0, a5 = 0;
     AST sdl = 0, vdl=0, fdl=0;  /* struct, var and func decl list */
+    memberspan sp;
+    int c;
 
-    a1 = classhead();
+    begin_span(p, &sp);
+    a1 = classhead(p);
 
     if (t->sym == '{') {
 	gettoken();
@@ -185,16 +314,28 @@ static AST classdecl() {
 	vdl = new_list(nVARDECLS);
 	fdl = new_list(nFUNCDECLS);
 
-	a2 = structdecls(sdl);
-	if (t->sym == tCLASS) a3 = classdecls();
-	a4 = vardecls(vdl, fdl);
-	a5 = funcdecls(fdl);
+	a2 = structdecls(p, sdl);
+	c = push_ctx(p, a2);
+	if (t->sym == tCLASS) a3 = classdecls(p);
+	p->ctxs[c].cdl = a3;
+	a4 = vardecls(p, vdl);
+	a5 = funcdecls(p, fdl);
+	if (t->sym != '}' && t->sym != tEND) parse_error("expected a member or }");
+	while (t->sym != '}' && t->sym != tEND && !errors_over_limit()) {
+	    if (skipto(member_sync) == ';') gettoken();
+	    vardecls(p, vdl);
+	    funcdecls(p, fdl);
+	}
+	p->cur_ctx = p->ctxs[c].outer;
 	leave_block();
 
 	if (t->sym == '}') {
 	    gettoken();
 	    a = make_AST(nCLASSBODY, a2, a3, a4, a5);
 	    a = make_AST(nCLASSDECL, a1, a, 0, 0);
+	    make_class_SYM(a);
+	    if (!checks_deferred()) layout_record(get_son0(a1), a4, a5);
+	    if (p->cur_ctx < 0) end_span(p, &sp, a);
 	} else {
 	    parse_error("expected }");
 	}
@@ -205,14 +346,14 @@ static AST classdecl() {
     return a;
 }
 
-static AST classhead() {
-    Token *t = &tok;
+static AST classhead(Parser *p) {
+    Token *t = p->t;
     AST a=0;
     AST a1=0, a2=0;
 
     if (t->sym == tCLASS) {
 	gettoken();
-	a1 = classname();
+	a1 = classname(p);
 	if (a1) {
 	    insert_SYM(get_text(a1), 0, tGLOBAL, 0); /* dummy */
 	}
@@ -227,25 +368,23 @@ static bool isprimtype(int k) {
     return (k==tINT || k==tCHAR || k==tFLOAT || k==tSTRING);
 }
 
-static bool isclasstype(){
-    Token *t = &tok;
+static bool isclasstype(Parser *p){
+    Token *t = p->t;
     if (t->sym == ID) {
-	char *text = strdup(t->text);
-	AST idx = lookup_SYM_all(text);
-	if (idx == 0) return false;
-	AST type = make_AST_name(text);
+	AST idx = lookup_SYM_all(t->text);
+	if (idx == 0 || getprop_SYM(idx) != tGLOBAL) return false; /* not a type */
+	AST type = make_AST_name(strdup(t->text));
 	if (nodetype(type) == tCLASS) return true;
     }
     return false;
 }
 
-static bool isstructtype(){
-    Token *t = &tok;
+static bool isstructtype(Parser *p){
+    Token *t = p->t;
     if (t->sym == ID) {
-	char *text = strdup(t->text);
-	AST idx = lookup_SYM_all(text);
-	if (idx == 0) return false;
-	AST type = make_AST_name(text);
+	AST idx = lookup_SYM_all(t->text);
+	if (idx == 0 || getprop_SYM(idx) != tGLOBAL) return false; /* not a type */
+	AST type = make_AST_name(strdup(t->text));
 	if (nodetype(type) == tSTRUCT) return true;
     }
     return false;
@@ -254,79 +393,73 @@ static bool isrettype(int k){
     return isprimtype(k) || k == tVOID;
 }
 
-static AST structdecls(AST sdl){
-    Token *t = &tok;
+/* at the type of a member : the token after its ID is '(' */
+static bool ismethod(Parser *p) {
+    Token *t;
+    int k = 1;
+
+    while ((t = peek(k)) && t->sym == '[') k += 3;	/* mod : '[' con ']' */
+    return t && t->sym == ID && (t = peek(k+1)) && t->sym == '(';
+}
+
+static AST structdecls(Parser *p, AST sdl){
+    Token *t = p->t;
     AST a = 0;
     while (true){
 	if (t->sym != tSTRUCT) break;
 	gettoken();
-	a = structdecl();
+	a = structdecl(p);
 	if (a) sdl = append_list(sdl, a);
     }
     return sdl;
 }
 
-static AST vardecls(AST vdl, AST fdl) {
-    Token *t = &tok;
+static AST vardecls(Parser *p, AST vdl) {
+    Token *t = p->t;
     AST a=0;
     AST a1=0;
-    bool isfuncdecl = false;
 
     while (true) {
-	if (!isprimtype(t->sym) && !isclasstype() && !isstructtype()) break;
-	a1 = vardecl();
-	if (a1 && nodetype(a1) == nFUNCDECL) /* expect var, but it was func */
-	{ isfuncdecl = true; break; }
+	if (!isprimtype(t->sym) && !isclasstype(p) && !isstructtype(p)) break;
+	if (ismethod(p)) break;		/* left to funcdecls() */
+	a1 = vardecl(p);
 	if (a1) vdl = append_list(vdl, a1);
 
 	if (t->sym == ';') gettoken();
-	else parse_error("expected ;");
-    }
-
-    if (isfuncdecl) {
-	fdl = append_list(fdl, a1);    /* add first elem of fdl */
+	else {
+	    parse_error("expected ;");
+	    if (errors_over_limit()) break;
+	    if (skipto(decl_sync) == ';') gettoken();
+	}
     }
-
     return vdl;
 }
 
-static AST funcdecls(AST fdl) {
-    Token *t = &tok;
+static AST funcdecls(Parser *p, AST fdl) {
+    Token *t = p->t;
     AST a=0;
     AST a1=0;
 
     while (true) {
-	if ( !isrettype(t->sym) && !isclasstype() && !isstructtype()) break;
-	a1 = funcdecl();
+	if ( !isrettype(t->sym) && !isclasstype(p) && !isstructtype(p)) break;
+	a1 = funcdecl(p);
 	if(a1) fdl = append_list(fdl, a1);
+	else if (errors_over_limit()) break;
+	else if (skipto(decl_sync) == ';') gettoken();
     }
     return fdl;
 }
 
-static AST vardecl() { /* TODO: allow vars */
-    Token *t = &tok;
+static AST vardecl(Parser *p) { /* TODO: allow vars */
+    Token *t = p->t;
     AST a=0;
-    AST a1=0,a2=0,a3=0,a4=0;
-    AST ft;
+    AST a1=0,a2=0;
     int idx;
 
-    a2 = typedecl();
-    a1 = var();		
-
-    if (t->sym == '(') { /* oops, it was func */
-	gettoken();
-	set_nodetype(a1, nNAME); /* change to NAME */
-	insert_SYM(get_text(a1), ft=func_type(gen(fLOCAL),a2), fLOCAL,0 /* dummy */ );
-
-	a3 = argdecls();
-	set_argtypeofnode(ft,a3);
+    a2 = typedecl(p);
+    a1 = var(p);		
 
-	if (t->sym == ')') gettoken();
-	else parse_error("expected )");
-
-	a4 = block();
-	a  = make_AST_funcdecl(a1, a2, a3, a4);
-    } else if (t->sym == ';') { /* vardecl */
+    if (t->sym == ';') { /* vardecl */
 	a = make_AST_vardecl(a1, a2, 0, 0);
 	idx = insert_SYM(get_text(a1), a2, vLOCAL, a1); 
 	set_ival(a1,idx);
@@ -341,16 +474,16 @@ static AST vardecl() { /* TODO: allow vars */
     return a;
 }
 
-static AST structdecl(){
-    Token *t = &tok;
+static AST structdecl(Parser *p){
+    Token *t = p->t;
 
-    AST struct_name = structname();
+    AST struct_name = structname(p);
     insert_SYM(get_text(struct_name), 0, tGLOBAL, 0); /* dummy */
     AST a = new_list(nVARDECLS);
     if (t->sym == '{'){
 	enter_block();
 	gettoken();
-	a = vardecls(a, 0);
+	a = vardecls(p, a);
 	leave_block();
 	if (t->sym == '}') gettoken();
 	else parse_error("Expected }");
@@ -358,6 +491,7 @@ static AST structdecl(){
 	if (t->sym == ';') gettoken();
 	else parse_error("Expected ;");
 
+	layout_record(struct_name, a, 0);
 	a = make_AST_structdecl(struct_name, a);
     } else {
 	parse_error("Expected {");
@@ -365,31 +499,40 @@ static AST structdecl(){
     return a;
 }
 
-static AST funcdecl() {
-    Token *t = &tok;
+static AST funcdecl(Parser *p) {
+    Token *t = p->t;
     AST a=0;
     AST a1=0,a2=0,a3=0,a4=0;
     AST ftype;
+    memberspan sp;
+    int idx, k = -1;
 
-    a2 = retdecl();
-    a1 = name();
+    begin_span(p, &sp);
+    a2 = retdecl(p);
+    a1 = name(p);
     ftype = func_type(gen(fLOCAL),a2);
-    insert_SYM(get_text(a1), ftype, fLOCAL, 0/* dummy */);
+    idx = insert_SYM(get_text(a1), ftype, fLOCAL, 0/* dummy */);
 
     if (t->sym == '(') { /* must be func */
 	gettoken();
 
+	if (p->skeleton) reset_offset();	/* no block() in between to do it */
 	mark_args();
-	a3 = argdecls();
+	a3 = argdecls(p);
 	if (checkFuncExist(get_text(a1), a3)) parse_error("Duplicated function definition");
 	set_argtypeofnode(ftype,a3);
+	register_func_SYM(idx);
 
 	if (t->sym == ')') gettoken();
 	else parse_error("expected )");
 
-	a4 = block();
+	if (p->skeleton && t->sym == '{') k = skip_body(p);
+	else a4 = block(p);
+	if (!checks_deferred()) layout_frame(a4);
 	unmark_args();
 	a  = make_AST_funcdecl(a1,a2,a3,a4);
+	if (k >= 0) p->lazy[k].func = a;
+	end_span(p, &sp, a);
 
     } else {
 	parse_error("expected (");
@@ -397,32 +540,32 @@ static AST funcdecl() {
     return a;
 }
 
-static AST typedecl() {
-    Token *t = &tok;
+static AST typedecl(Parser *p) {
+    Token *t = p->t;
     AST a=0;
-    a = vartype();
-    a = mod(a);
+    a = vartype(p);
+    a = mod(p, a);
     return a; 
 }
 
-static AST retdecl(){
-    Token *t = &tok;
+static AST retdecl(Parser *p){
+    Token *t = p->t;
     AST a=0;
-    a = rettype();
-    a = mod(a);
+    a = rettype(p);
+    a = mod(p, a);
     return a; 
 }
 
-static AST mod(AST elem) {
-    Token *t = &tok;
+static AST mod(Parser *p, AST elem) {
+    Token *t = p->t;
     AST a,a1=0;
     int sz;
 
     a = elem;
     if (t->sym == '[') {
 	gettoken();
-	a1 = con();
-	sz = get_ival(a1);
+	a1 = con(p);
+	sz = getval_SYM(get_ival(a1));	/* con() gives the constant symbol */
 
 	if (sz <= 0) { parse_error("size must be positive"); sz = 1; }
 
@@ -430,13 +573,13 @@ static AST mod(AST elem) {
 	else parse_error("expected ]");
 
 	a = array_type(gen(tGLOBAL), elem, sz);
-	a = mod(a);
+	a = mod(p, a);
     }
     return a;
 }
 
-static AST vartype() {
-    Token *t = &tok;
+static AST vartype(Parser *p) {
+    Token *t = p->t;
     AST a=0, idx = 0;
     char *text;
 
@@ -457,20 +600,20 @@ static AST vartype() {
     return a;
 }
 
-static AST rettype(){
-    Token *t = &tok;
+static AST rettype(Parser *p){
+    Token *t = p->t;
     AST a=0;
 
     switch (t->sym) {
 	case tVOID:    a = make_AST_name("void"); break;
-	default:     return vartype(); 
+	default:     return vartype(p); 
     }
     gettoken();
     return a;
 }
 
-static AST argdecls() {
-    Token *t = &tok;
+static AST argdecls(Parser *p) {
+    Token *t = p->t;
     AST a=0;
     AST a1=0;
 
@@ -478,30 +621,34 @@ static AST argdecls() {
     while (true) {
 	if (t->sym == ')') break;
 	if ( !isprimtype(t->sym) ) break;
-	a1 = argdecl();
+	a1 = argdecl(p);
 	if(a1) a = append_list(a, a1);
 
-	if (t->sym == ',') gettoken();
+	if (t->sym == ',') { gettoken(); continue; }
+	if (t->sym == ')') break;
+	parse_error("expected , or )");
+	if (errors_over_limit() || skipto(argdecl_sync) != ',') break;
+	gettoken();
     }
     return a;
 }
 
-static AST argdecl() {
-    Token *t = &tok;
+static AST argdecl(Parser *p) {
+    Token *t = p->t;
     AST a=0;
     AST a1=0,a2=0;
     int idx;
 
-    a2 = typedecl();
-    a1 = var();
+    a2 = typedecl(p);
+    a1 = var(p);
     a  = make_AST_argdecl(a1, a2);
     idx = insert_SYM(get_text(a1), a2, vARG, a1);
     set_ival(a1,idx);
     return a;
 }
 
-static AST block() {
-    Token *t = &tok;
+static AST block(Parser *p) {
+    Token *t = p->t;
     AST a=0;
     AST vdl, fdl, sts;
 
@@ -510,12 +657,14 @@ static AST block() {
     if(t->sym == '{') {
 	gettoken();
 	enter_block();
+	p->blocks++;
 
-	vardecls(vdl,fdl);
-	funcdecls(fdl);
-	sts = stmts();
+	vardecls(p, vdl);
+	funcdecls(p, fdl);
+	sts = stmts(p);
 
 	a = make_AST(nBLOCK, vdl, fdl, sts, 0);
+	p->blocks--;
 	leave_block();
 
 	if (t->sym == '}') gettoken();
@@ -527,8 +676,489 @@ static AST block() {
     return a;
 }
 
-static AST stmts() {
-    Token *t = &tok;
+/* keep the type names of a class for its bodies; it becomes the current class */
+static int push_ctx(Parser *p, AST sdl) {
+    classctx *cp;
+
+    if (p->ctx_cnt >= p->ctx_max) {
+	p->ctx_max = (p->ctx_max) ? p->ctx_max * 2 : 16;
+	p->ctxs = (classctx *)realloc(p->ctxs, p->ctx_max * sizeof(classctx));
+    }
+    cp = &p->ctxs[p->ctx_cnt];
+    cp->sdl = sdl;
+    cp->cdl = 0;
+    cp->outer = p->cur_ctx;
+    return p->cur_ctx = p->ctx_cnt++;
+}
+
+/* a member begins at the current token */
+static void begin_span(Parser *p, memberspan *sp) {
+    Token *t = p->t;
+
+    sp->before_no = t->prev_no;
+    sp->no = t->no;
+    sp->pos = t->pos;
+    sp->sym = count_SYM() + 1;
+}
+
+/* it ended before the current token; kept unless it is inside a body */
+static void end_span(Parser *p, memberspan *sp, AST decl) {
+    Token *t = p->t;
+
+    if (decl == 0 || p->blocks > 0) return;
+    if (p->span_cnt >= p->span_max) {
+	p->span_max = (p->span_max) ? p->span_max * 2 : 64;
+	p->spans = (memberspan *)realloc(p->spans, p->span_max * sizeof(memberspan));
+    }
+    sp->decl = decl;
+    sp->ctx = p->cur_ctx;
+    sp->sym_end = count_SYM();
+    sp->last_no = t->prev_no;
+    sp->after_no = t->no;
+    sp->after_pos = t->pos;
+    p->spans[p->span_cnt++] = *sp;
+}
+
+/* the body at '{' is only matched by its braces, to be parsed by parse_body() */
+static int skip_body(Parser *p) {
+    Token *t = p->t;
+    lazybody *lb;
+    int depth = 0;
+
+    if (p->lazy_cnt >= p->lazy_max) {
+	p->lazy_max = (p->lazy_max) ? p->lazy_max * 2 : 64;
+	p->lazy = (lazybody *)realloc(p->lazy, p->lazy_max * sizeof(lazybody));
+    }
+    lb = &p->lazy[p->lazy_cnt];
+    lb->func = 0;
+    lb->ctx = p->cur_ctx;
+    tell_input(&lb->no, &lb->pos);
+    lb->pos--;			/* back to the '{' */
+
+    while (true) {
+	if (t->sym == '{') depth++;
+	else if (t->sym == '}' && --depth == 0) break;
+	if (gettoken() == 0) break;
+    }
+    tell_input(&lb->end_no, &lb->end_pos);
+    if (depth == 0) gettoken();
+    else parse_error("expected }");
+    return p->lazy_cnt++;
+}
+
+/* a type name entered again; it has its loc from the first time */
+static void reenter(char *name) {
+    setprop_SYM(insert_SYM(name, 0, 0, 0), tGLOBAL);
+}
+
+/* the type names around a body in scopes of their own, as when it was read */
+static int reopen(Parser *p, int c) {
+    AST l, e;
+    int depth;
+
+    if (c < 0) return 0;
+    depth = reopen(p, p->ctxs[c].outer);
+    enter_block();
+    for (l = p->ctxs[c].sdl; l; ) {
+	get_sons(l, &e, &l, 0, 0);
+	if (e) reenter(get_text(get_son0(e)));
+    }
+    for (l = p->ctxs[c].cdl; l; ) {
+	get_sons(l, &e, &l, 0, 0);
+	if (e) reenter(get_text(get_son0(get_son0(e))));
+    }
+    return depth + 1;
+}
+
+/* read the body at lb in the scopes it was left in */
+static AST read_body(Parser *p, lazybody *lb) {
+    bool skel = p->skeleton;
+    int depth = reopen(p, lb->ctx);
+    AST body;
+
+    reset_errors();		/* a unit of its own */
+    seek_input(lb->no, lb->pos);
+    gettoken();
+    p->skeleton = false;
+    body = block(p);
+    p->skeleton = skel;
+    while (depth-- > 0) leave_block();
+    return body;
+}
+
+/* parse the body a skeleton left out of func and put it in; returns it */
+AST parse_body(Parser *p, AST func) {
+    lazybody *lb = 0;
+    AST n, ty, args, body;
+    int lo = 0, hi = p->lazy_cnt-1;
+
+    while (lo <= hi) {		/* funcs are made in order */
+	int mid = (lo + hi) / 2;
+	if (p->lazy[mid].func == func) { lb = &p->lazy[mid]; break; }
+	if (p->lazy[mid].func < func) lo = mid+1;
+	else hi = mid-1;
+    }
+    get_sons(func, &n, &ty, &args, &body);
+    if (lb == 0 || body) return body;
+
+    body = read_body(p, lb);
+    set_sons(func, n, ty, args, body);
+    return body;
+}
+
+/*
+   parallel bodies : every worker has a context of its own, starting
+   from a copy of the skeleton's nodes and reading the kept source.
+   the workers take the bodies one at a time and hold back their
+   diagnostics.  their nodes are then spliced after the skeleton's,
+   and each body in turn has its declarations and constants entered
+   again by relink(), in the order parse_body() would have made them.
+   a body declaring functions of its own is left to parse_body().
+ */
+typedef struct donebody {
+    int  w;		/* worker, or -1 */
+    AST  body;		/* in the nodes of the worker */
+    char *diag;
+} donebody;
+
+typedef struct bodypool {
+    Parser *p;
+    Context **cx;	/* of each worker */
+    donebody *done;
+    AST  base;		/* the nodes of the skeleton */
+    int  next;
+    pthread_mutex_t lock;
+} bodypool;
+
+typedef struct bodyworker {
+    bodypool *bp;
+    int  w;
+} bodyworker;
+
+static void *body_worker(void *arg) {
+    bodyworker *bw = (bodyworker *)arg;
+    bodypool *bp = bw->bp;
+    Parser *p = bp->p, ps;
+    donebody *dp;
+    AST l, e, n, top;
+    int i, fcnt;
+    size_t len;
+    FILE *fp;
+
+    bp->cx[bw->w] = new_context(0);
+    fork_AST(p->cx->ast);
+    share_input(p->cx->tok);
+    for (l = get_son0(p->root); l; ) {	/* as classhead() left them */
+	get_sons(l, &e, &l, 0, 0);
+	if (e && (n = get_son0(get_son0(e))))
+	    insert_SYM(get_text(n), 0, tGLOBAL, 0); /* dummy */
+    }
+    init_parser(&ps, bp->cx[bw->w]);
+    ps.ctxs = p->ctxs;
+    ps.ctx_cnt = p->ctx_cnt;
+
+    while (true) {
+	pthread_mutex_lock(&bp->lock);
+	i = bp->next++;
+	pthread_mutex_unlock(&bp->lock);
+	if (i >= p->lazy_cnt) break;
+
+	dp = &bp->done[i];
+	top = count_AST();
+	fcnt = select_AST(nFUNCDECL, 0, 0);
+	fp = open_memstream(&dp->diag, &len);
+	set_error_output(fp);
+	dp->body = read_body(&ps, &p->lazy[i]);
+	set_error_output(0);
+	fclose(fp);
+	if (select_AST(nFUNCDECL, 0, 0) == fcnt) dp->w = bw->w;
+	else rollback_AST(top);
+    }
+    return arg;
+}
+
+/* the constant at a, made by the context w, entered in this one */
+static int relink_con(Context *w, AST a) {
+    Context *cx = cur_context();
+    int ty = get_typeofnode(a), k = get_ival(a), val;
+    char *text = "";
+
+    use_context(w);
+    val = getval_SYM(k);
+    if (!is_immediate_CON(ty)) {	/* val is where its text is */
+	text = get_STR(val);
+	val = 0;
+    }
+    use_context(cx);
+    return insert_CON(ty, val, text);
+}
+
+static void relink_type(Context *w, AST ty, AST base) {
+    int sz;
+
+    if (ty <= base || nodetype(ty) != tARRAY) return;
+    relink_type(w, get_typeofnode(ty), base);
+    sz = get_ival(ty);
+    insert_CON(PRIM_INT, sz, "");	/* by mod() */
+    set_node(ty, tARRAY, gen(tGLOBAL), sz);
+    get_typeid(ty);
+}
+
+/* enter the symbols of the spliced nodes from a down, as block() did */
+static void relink(Context *w, AST a, AST base) {
+    AST s[4];
+    int i;
+
+    if (a <= base) return;	/* the skeleton's */
+    get_sons(a, &s[0], &s[1], &s[2], &s[3]);
+    switch (nodetype(a)) {
+	case nBLOCK:
+	    enter_block();
+	    for (i=0;i<4;i++) relink(w, s[i], base);
+	    leave_block();
+	    return;
+	case nVARDECL:
+	    relink_type(w, s[1], base);
+	    set_ival(s[0], insert_SYM(get_text(s[0]), s[1], vLOCAL, s[0]));
+	    return;
+	case nCON:
+	    if (*get_text(a) == 0) set_ival(a, relink_con(w, a)); /* not true/false */
+	    return;
+    }
+    for (i=0;i<4;i++) relink(w, s[i], base);
+}
+
+/* parse every body the skeleton left out, on n threads */
+void parse_bodies(Parser *p, int n) {
+    bodypool pool, *bp = &pool;
+    bodyworker *bws;
+    pthread_t *tids;
+    donebody *dp;
+    lazybody *lb;
+    AST nm, ty, args, body;
+    int *delta;
+    int i, w, depth;
+
+    if (n > p->lazy_cnt) n = p->lazy_cnt;
+    if (n <= 1) {
+	for (i=0;i<p->lazy_cnt;i++) parse_body(p, p->lazy[i].func);
+	return;
+    }
+    memset(bp, 0, sizeof(bodypool));
+    bp->p = p;
+    bp->base = count_AST();
+    bp->cx = (Context **)calloc(n, sizeof(Context *));
+    bp->done = (donebody *)calloc(p->lazy_cnt, sizeof(donebody));
+    for (i=0;i<p->lazy_cnt;i++) bp->done[i].w = -1;
+    pthread_mutex_init(&bp->lock, 0);
+
+    bws = (bodyworker *)malloc(n * sizeof(bodyworker));
+    tids = (pthread_t *)malloc(n * sizeof(pthread_t));
+    for (w=0;w<n;w++) {
+	bws[w].bp = bp;
+	bws[w].w = w;
+	pthread_create(&tids[w], 0, body_worker, &bws[w]);
+    }
+    for (w=0;w<n;w++) pthread_join(tids[w], 0);
+
+    delta = (int *)malloc(n * sizeof(int));
+    for (w=0;w<n;w++) delta[w] = splice_AST(bp->cx[w]->ast, bp->base);
+    for (i=0;i<p->lazy_cnt;i++) {
+	dp = &bp->done[i];
+	lb = &p->lazy[i];
+	if (dp->w < 0) {
+	    parse_body(p, lb->func);
+	} else {
+	    fputs(dp->diag, stdout);
+	    body = (dp->body) ? dp->body + delta[dp->w] : 0;
+	    depth = reopen(p, lb->ctx);
+	    relink(bp->cx[dp->w], body, bp->base);
+	    while (depth-- > 0) leave_block();
+	    get_sons(lb->func, &nm, &ty, &args, 0);
+	    set_sons(lb->func, nm, ty, args, body);
+	}
+	free(dp->diag);
+    }
+
+    for (w=0;w<n;w++) free_context(bp->cx[w]);
+    pthread_mutex_destroy(&bp->lock);
+    free(delta);
+    free(tids);
+    free(bws);
+    free(bp->done);
+    free(bp->cx);
+}
+
+/*
+   incremental reparse : lines of the kept source are replaced, and the
+   smallest class or method whose lines hold all of the edit is read
+   again in the scopes of its class and put in place of the old node.
+   the symbols made for the old one are retired, and its struct and
+   inner class nodes are taken out of the names make_AST_name() finds.
+   the class node of a class read again stays, as the rest of the tree
+   refers to it.
+ */
+
+/* is the token at no, pos inside the member m */
+static bool inside(memberspan *m, int no, int pos) {
+    if (no < m->no || (no == m->no && pos < m->pos)) return false;
+    if (no > m->after_no || (no == m->after_no && pos >= m->after_pos)) return false;
+    return true;
+}
+
+/* the member holding lines no..hi, or an insertion before no if hi < no */
+static memberspan *find_span(Parser *p, int no, int hi) {
+    memberspan *m, *best = 0;
+    int i;
+
+    for (i=0;i<p->span_cnt;i++) {
+	m = &p->spans[i];
+	if (m->before_no >= no || m->after_no <= hi) continue;
+	if (hi < no) {
+	    if (no <= m->no || no > m->last_no) continue;
+	} else {
+	    if (no < m->no || hi > m->last_no) continue;
+	}
+	if (best == 0 || m->last_no - m->no < best->last_no - best->no) best = m;
+    }
+    return best;
+}
+
+/* the variables of a, some of them made by bodies read after it */
+static void retire_vars(AST a) {
+    AST s[4];
+    int i;
+
+    if (a == 0) return;
+    if (nodetype(a) == nVAR) {
+	retire_SYM(get_ival(a));
+	return;
+    }
+    if (isleaf(a)) return;
+    get_sons(a, &s[0], &s[1], &s[2], &s[3]);
+    for (i=0;i<4;i++) retire_vars(s[i]);
+}
+
+/* the struct and inner class nodes of a class */
+static void retire_types(AST classdecl) {
+    AST body = 0, sdl = 0, cdl = 0, e = 0, l;
+
+    get_sons(classdecl, 0, &body, 0, 0);
+    get_sons(body, &sdl, &cdl, 0, 0);
+    for (l = sdl; l; ) {
+	get_sons(l, &e, &l, 0, 0);
+	if (e && get_son0(e)) set_nodetype(get_son0(e), nERROR);
+    }
+    for (l = cdl; l; ) {
+	get_sons(l, &e, &l, 0, 0);
+	if (e == 0) continue;
+	if (get_son0(get_son0(e))) set_nodetype(get_son0(get_son0(e)), nERROR);
+	retire_types(e);
+    }
+}
+
+static void replace_son(AST a, AST old, AST new) {
+    AST s[4];
+    int i;
+
+    get_sons(a, &s[0], &s[1], &s[2], &s[3]);
+    for (i=0;i<4;i++)
+	if (s[i] == old) s[i] = new;
+    set_sons(a, s[0], s[1], s[2], s[3]);
+}
+
+/*
+   put text in place of the cnt lines from no and read the member
+   holding them again; returns it, or 0 if no member holds the edit or
+   the new text reaches past it.  the source must have been kept, as
+   by a skeleton.  the new member is not checked here, see
+   check_member_SEMA().
+
+   after 0 for no member, nothing has changed.  after 0 for text that
+   reaches past the member, the source holds the edit but the tree does
+   not : the old member is still in it with its symbols retired, and its
+   spans and lazy bodies are gone.  the whole source is to be read again.
+ */
+AST reparse(Parser *p, int no, int cnt, char *text) {
+    Token *t = p->t;
+    memberspan *sp, m;
+    lazybody *lb;
+    bool skel = p->skeleton;
+    AST old, a, head, cls, n;
+    int i, j, k, d, depth, cur, hi = no + cnt - 1;
+
+    if ((sp = find_span(p, no, hi)) == 0) return 0;
+    m = *sp;
+    old = m.decl;
+
+    /* what was made for the old member goes */
+    for (k = m.sym; k <= m.sym_end; k++) retire_SYM(k);
+    retire_vars(old);
+    if (nodetype(old) == nCLASSDECL) retire_types(old);
+    for (i=j=0;i<p->lazy_cnt;i++) {
+	lb = &p->lazy[i];
+	if (inside(&m, lb->no, lb->pos)) continue;
+	p->lazy[j++] = *lb;
+    }
+    p->lazy_cnt = j;
+    for (i=j=0;i<p->span_cnt;i++) {
+	sp = &p->spans[i];
+	if (inside(&m, sp->no, sp->pos)) continue;
+	p->spans[j++] = *sp;
+    }
+    p->span_cnt = j;
+
+    /* the lines after the edit move */
+    d = edit_input(no, cnt, text);
+    if (d) move_lines_AST(hi, d);
+    for (i=0;i<p->lazy_cnt;i++) {
+	lb = &p->lazy[i];
+	if (lb->no > hi) lb->no += d;
+	if (lb->end_no > hi) lb->end_no += d;
+    }
+    for (i=0;i<p->span_cnt;i++) {
+	sp = &p->spans[i];
+	if (sp->before_no > hi) sp->before_no += d;
+	if (sp->no > hi) sp->no += d;
+	if (sp->last_no > hi) sp->last_no += d;
+	if (sp->after_no > hi) sp->after_no += d;
+    }
+    m.after_no += d;
+
+    depth = reopen(p, m.ctx);
+    reset_errors();
+    seek_input(m.no, m.pos);
+    gettoken();
+    cur = p->cur_ctx;
+    p->cur_ctx = m.ctx;
+    p->skeleton = false;
+    a = (nodetype(old) == nFUNCDECL) ? funcdecl(p) : classdecl(p);
+    p->skeleton = skel;
+    p->cur_ctx = cur;
+    while (depth-- > 0) leave_block();
+    if (a == 0 || t->no != m.after_no || t->pos != m.after_pos) return 0;
+
+    replace_son(get_father(old), old, a);
+    if (nodetype(a) == nFUNCDECL) {
+	for (cls = get_father(a); cls && nodetype(cls) != nCLASSDECL; cls = get_father(cls))
+	    ;
+	if (cls) make_class_SYM(cls);
+    } else {
+	head = get_son0(a);
+	n = get_son0(get_son0(old));
+	if (n && get_son0(head) && strcmp(get_text(n), get_text(get_son0(head))) == 0) {
+	    set_nodetype(get_son0(head), nERROR);
+	    set_sons(head, n, 0, 0, 0);
+	    make_class_SYM(a);
+	} else if (n) {
+	    set_nodetype(n, nERROR);
+	}
+    }
+    return a;
+}
+
+static AST stmts(Parser *p) {
+    Token *t = p->t;
     AST a=0;
     AST a1=0, a2=0 ;
 
@@ -540,63 +1170,88 @@ static AST stmts() {
 	    default:
 		return a;
 	}
-	a1 = stmt();
+	a1 = stmt(p);
 	a = append_list(a, a1);
     }
     return a;
 }
 
-static AST stmt() {
-    Token *t = &tok;
+/* after an error : go on from the next stmt, an ID may begin it */
+static void skip_stmt(Parser *p) {
+    if (p->t->sym != ID && skipto(stmt_sync) == ';') gettoken();
+}
+
+/* the ; after a stmt, which may be left out before what follows one */
+static void end_stmt(Parser *p) {
+    switch (p->t->sym) {
+	case ';':
+	    gettoken();
+	    return;
+	case ID: case tIF: case tRETURN: case tELSE: case '{': case '}':
+	    return;
+    }
+    parse_error("expected ;");
+    skip_stmt(p);
+}
+
+static AST stmt(Parser *p) {
+    Token *t = p->t;
     AST a=0;
     AST a1=0;
     AST n;
     AST type;
 
     switch (t->sym) {
-	case ID: /* ASN or CALL */
-	    n = vName();
+	case ID: /* ASN or CALL, told by the token after */
+	    if (peek(1)->sym == ASNOP || peek(1)->sym == '[') {
+		a1 = asnstmt(p);
+		end_stmt(p);
+		break;
+	    }
+	    n = vName(p);
             char *s = get_text(n);
-	    if (t->sym == ASNOP || t->sym == '[') {
-		int idx = lookup_SYM_all(s);
-		if (idx == 0) parse_error("Undefined symbol");
-		a1 = asnstmt(n);
-		if (t->sym == ';') gettoken();
-	    } else if (t->sym == '(') {
-		a1 = callstmt(n);
+	    if (t->sym == '(') {
+		a1 = callstmt(p, n);
 		AST args = 0;
 		get_sons(a1, 0, 0, &args, 0);
-    		if (!checkFuncExistAll(s, args)) parse_error("No defined functions matches types of passed arguments");
-		if (t->sym == ';') gettoken();
+    		if (!checks_deferred() && !checkFuncExistAll(s, args)) parse_error("No defined functions matches types of passed arguments");
+		end_stmt(p);
 	    } else if (t->sym == '.'){
 		gettoken();
-		type = typeof_AST(n);
-		if (nodetype(type) == tCLASS){
-		    AST function_name = vName();
-		    a1 = callstmt(function_name);
+		type = (checks_deferred()) ? 0 : typeof_AST(n);
+		if (checks_deferred()) { /* the receiver is checked by sema */
+		    AST function_name = vName(p);
+		    AST args = 0;
+		    a1 = callstmt(p, function_name);
+		    get_sons(a1, 0, 0, &args, 0);
+		    set_sons(a1, n, function_name, args, 0);
+		    end_stmt(p);
+		} else if (nodetype(type) == tCLASS){
+		    AST function_name = vName(p);
+		    a1 = callstmt(p, function_name);
 		    AST args = 0;
 		    get_sons(a1, 0, 0, &args, 0);
 		    /*set_sons(a1, n, function_name, args, 0);*/
     		    if (!checkFuncExistClass(type, get_text(function_name), args)) parse_error("No defined functions of the class matches types of passed arguments");
-		    if (t->sym == ';') gettoken();
+		    end_stmt(p);
 		} else {
 		    parse_error("Symbol must be instance of a class");
-		    skiptoken(';');
+		    skip_stmt(p);
 		}
 	    }else {
 		parse_error("expected ASNOP or Funcall");
-		skiptoken(';');
+		skip_stmt(p);
 	    }
 	    break;
 	case tIF:
-	    a1 = ifstmt();
+	    a1 = ifstmt(p);
 	    break;
 	case tRETURN:
-	    a1 = returnstmt();
-	    if (t->sym == ';') gettoken();
+	    a1 = returnstmt(p);
+	    end_stmt(p);
 	    break;
 	case '{':
-	    a1 = block();
+	    a1 = block(p);
 	    break;
 	default:
 	    break;
@@ -606,38 +1261,32 @@ static AST stmt() {
     return a;
 }
 
-static AST asnstmt(AST name) {
-    Token *t = &tok;
+static AST asnstmt(Parser *p) {
+    Token *t = p->t;
     AST a=0;
     AST a1=0,a2=0;
     int idx,op;
+    char *s = strdup(t->text);
 
-    switch (t->sym) {
-	case ASNOP: /* change name to VREF */
-	    set_nodetype(name, nVREF);
-	    idx = lookup_SYM_all(get_text(name));
-	    set_ival(name,idx);
-	    a1 = name;
-	    break;
-	case '[': /* change name to LVAL */
-	    set_nodetype(name, nVREF);
-	    a2 = exprs();
-	    a1 = make_AST(nLVAL, name, a2, 0, 0) ;
-	    break;
-	default:
-	    break;
+    gettoken();
+    idx = (checks_deferred()) ? 0 : lookup_SYM_all(s);
+    if (!checks_deferred() && idx == 0) parse_error("Undefined symbol");
+    a1 = make_AST_vref(s, idx);
+    if (t->sym == '[') {
+	a2 = exprs(p);
+	a1 = make_AST(nLVAL, a1, a2, 0, 0);
     }
 
     op = t->ival;
     gettoken();
 
-    a2 = expr();
+    a2 = parse_expr(p);
     a = make_AST_asn(op,a1,a2);
     return a;
 }
 
-static AST ifstmt() {
-    Token *t = &tok;
+static AST ifstmt(Parser *p) {
+    Token *t = p->t;
     AST a=0;
     AST a1=0,a2=0,a3=0;
 
@@ -645,15 +1294,15 @@ static AST ifstmt() {
 	gettoken();
 	if (t->sym == '(') {
 	    gettoken();
-	    a1 = bexpr();
+	    a1 = parse_expr(p);
 
 	    if (t->sym == ')') gettoken();
 	    else parse_error("expected )");
 
-	    a2 = stmt();
+	    a2 = stmt(p);
 	    if (t->sym == tELSE) {   /* else is optional */
 		gettoken();
-		a3 = stmt();
+		a3 = stmt(p);
 	    }
 	} else {
 	    parse_error("expected (");
@@ -661,67 +1310,71 @@ static AST ifstmt() {
 	a = make_AST_if(a1,a2,a3);
     } else {
 	parse_error("expected if");
-	skiptoken(';');
+	skip_stmt(p);
     }
     return a;
 }
 
-static AST callstmt(AST name) {
-    Token *t = &tok;
+static AST callstmt(Parser *p, AST name) {
+    Token *t = p->t;
     AST a=0;
     AST a1=0,a2=0;
 
     if (t->sym == '(') gettoken();
     else parse_error("expected (");
 
-    a2 = argrefs();
+    a2 = argrefs(p);
 
 
     if (t->sym == ')') gettoken();
-    else parse_error("expected (");
+    else parse_error("expected )");
 
     a = make_AST(nCALL, 0, name, a2, 0);
     return a;
 }
 
-static AST argrefs() {
-    Token *t = &tok;
+static AST argrefs(Parser *p) {
+    Token *t = p->t;
     AST a,a1=0;
 
     a = new_list(nARGS); 
 
     while (true) {
 	if (t->sym == ')') break;
-	a1 = argref();
+	a1 = argref(p);
 
 	if (a1) a = append_list(a,a1);
 
-	if (t->sym == ',') gettoken();
+	if (t->sym == ',') { gettoken(); continue; }
+	if (t->sym == ')') break;
+	parse_error("expected , or )");
+	if (errors_over_limit() || skipto(argref_sync) != ',') break;
+	gettoken();
     }
     return a;
 }
 
-static AST argref() {
-    Token *t = &tok;
+static AST argref(Parser *p) {
+    Token *t = p->t;
     AST a,a1=0;
 
-    a1 = expr();
+    a1 = parse_expr(p);
     a = make_AST(nARG, a1, 0, 0, 0);
     return a;
 }
 
-static AST returnstmt() {
-    Token *t = &tok;
+static AST returnstmt(Parser *p) {
+    Token *t = p->t;
     AST a,a1=0;
 
     gettoken();
-    a1 = expr();
+    if (t->sym != ';') a1 = parse_expr(p);	/* return; */
     a = make_AST(nRET, a1, 0, 0, 0);
     return a;
 }
 
-static AST var() {
-    Token *t = &tok;
+static AST var(Parser *p) {
+    Token *t = p->t;
     AST a=0;
     int idx;
 
@@ -736,16 +1389,16 @@ static AST var() {
     return a;
 }
 
-static AST vref() {
-    Token *t = &tok;
+static AST vref(Parser *p) {
+    Token *t = p->t;
     AST a=0;
     int idx;
 
     if (t->sym == ID) {
 	char *s = strdup(t->text);
 	gettoken();
-	idx = lookup_SYM_all(s);
-	if (idx == 0) parse_error("undefined variable");
+	if (checks_deferred()) idx = 0;	/* resolved by sema */
+	else if ((idx = lookup_SYM_all(s)) == 0) parse_error("undefined variable");
 	a = make_AST_vref(s,idx);
     } else {
 	parse_error("expected ID");
@@ -753,22 +1406,22 @@ static AST vref() {
     return a;
 }
 
-static AST lval() {
-    Token *t = &tok;
+static AST lval(Parser *p) {
+    Token *t = p->t;
     AST a=0;
     AST a1=0,a2=0;
 
-    a1 = vref();
+    a1 = vref(p);
     if (t->sym == '[') {
-	a2 = exprs();
+	a2 = exprs(p);
 	a = make_AST(nLVAL, a1, a2, 0, 0);
     } else
 	a = a1;
     return a;
 }
 
-static AST name() {
-    Token *t = &tok;
+static AST name(Parser *p) {
+    Token *t = p->t;
     AST a=0;
 
     if (t->sym == ID) {
@@ -781,8 +1434,8 @@ static AST name() {
     return a;
 }
 
-static AST structname() {
-    Token *t = &tok;
+static AST structname(Parser *p) {
+    Token *t = p->t;
     AST a=0;
 
     if (t->sym == ID) {
@@ -800,8 +1453,8 @@ static AST structname() {
     return a;
 }
 
-static AST classname(){
-    Token *t = &tok;
+static AST classname(Parser *p){
+    Token *t = p->t;
     AST a=0;
 
     if (t->sym == ID) {
@@ -819,8 +1472,8 @@ static AST classname(){
     return a;
 }
 
-static AST vName(){
-    Token *t = &tok;
+static AST vName(Parser *p){
+    Token *t = p->t;
     AST a=0;
 
     if (t->sym == ID) {
@@ -833,32 +1486,20 @@ static AST vName(){
     return a;
 }
 
-static AST con() {
-    Token *t = &tok;
-    int v;
+static AST con(Parser *p) {
+    Token *t = p->t;
     int idx;
-    char *p;
-    char *s;
     AST ty=0;
     AST a=0;
 
-    v = t->ival;
-    p = gen(cLOCAL);
-    s = insert_STR(t->text);
-
-    if (t->sym >= ILIT && t->sym <= SLIT)
-	ty = (t->sym - ILIT) +1;
+    ty = littype_AST(t->sym);
 
     switch (t->sym) {
 	case ILIT: case CLIT: /* int, char */
-	    gettoken();
-	    idx = insert_SYM(p, 0, cLOCAL, v); /* immediate */
-	    a = make_AST_con(p,idx);
-	    break;
 	case FLIT: case SLIT: /* float, string */
+	    idx = insert_CON(ty, t->ival, t->text);
 	    gettoken();
-	    idx = insert_SYM(p, ty, cLOCAL, get_STR_offset(s));
-	    a = make_AST_con(p,idx);
+	    a = make_AST_con(0,idx);
 	    break;
 	default:
 	    parse_error("expected LIT");
@@ -869,15 +1510,15 @@ static AST con() {
     return a;
 }
 
-static AST exprs() {
-    Token *t = &tok;
+static AST exprs(Parser *p) {
+    Token *t = p->t;
     AST a,a1=0;
 
     a = new_list(nEXPRS);
     while (true) {
 	if (t->sym != '[') break;
 	gettoken();
-	a1 = expr();
+	a1 = parse_expr(p);
 	if (a1) a = append_list(a,a1);
 
 	if (t->sym == ']') gettoken();
@@ -886,28 +1527,3 @@ static AST exprs() {
     return a;
 }
 
-/* simplest version */
-static AST expr() {
-    Token *t = &tok;
-    switch (t->sym) {
-	case ID: return lval();
-	case ILIT: return con();
-	default: return 0;
-    }
-}
-
-/* dummy */
-static AST bexpr() {
-    Token *t = &tok;
-    char *s = strdup(t->text);
-    switch (t->sym) {
-	case tTRUE: 
-	    gettoken(); 
-	    return make_AST_con(s,1);
-	case tFALSE: 
-	    gettoken(); 
-	    return make_AST_con(s,0);
-	default: 
-	    return 0;
-    }
-}
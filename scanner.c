@@ -21,7 +21,8 @@ inline int isspace(int ch) {
     return (ch == ' ' || ch == '\t' || ch == '\r' || ch == '\n');
 }
 
-Token *gettoken() {
+/* the next token from the input, keywords told from IDs */
+static Token *scan() {
     Token *t;
 
     do {
@@ -35,41 +36,72 @@ Token *gettoken() {
     return  t;
 }
 
-void skiptoken(int sym) {
-    Token *t=&tok;
+/* the next token; 0 at the end of the input, where the current one is tEND */
+Token *gettoken() {
+    Token *t;
+    int prev_no = cur_token()->no;
 
-    while (t && t->sym != '\n') {
-	if (t->sym == sym)  break;
-	t = gettoken0();
-    }
+    t = (ahead(0)) ? pop_ahead() : scan();
+    if (t == 0) cur_token()->sym = tEND;
+    cur_token()->prev_no = prev_no;
+    return  t;
 }
 
-void skiptoken2(int sym1,int sym2) {
-    Token *t=&tok;
-    while (t && t->sym != '\n') {
-	if (t->sym == sym1)  break;
-	if (t->sym == sym2)  break;
-	t = gettoken0();
+/*
+   the k-th token past the current one, which stays current; 0 is the
+   current one.  the tokens read are kept in a ring until gettoken()
+   takes them, and the line as it was after each, so that diagnostics
+   and new nodes still see the place of the current token.
+   returns tEND at the end of the input, 0 past LOOKAHEAD.
+ */
+Token *peek(int k) {
+    Token cur, *t;
+
+    if (k == 0) return cur_token();
+    if (k > LOOKAHEAD) return 0;
+    while ((t = ahead(k-1)) == 0) {
+	cur = *cur_token();	/* the scanner reads into it */
+	if (!scan()) cur_token()->sym = tEND;
+	push_ahead(&cur);
     }
+    return t;
 }
 
-void skiptoken3(int sym1,int sym2,int sym3) {
-    Token *t=&tok;
-    while (t && t->sym != '\n') {
-	if (t->sym == sym1)  break;
-	if (t->sym == sym2)  break;
-	if (t->sym == sym3)  break;
-	t = gettoken0();
+/*
+   error recovery : skip to the nearest token of set, a list of syms
+   ended by 0, taken from FIRST and FOLLOW of the rule in error.  what
+   is in parentheses or braces opened while skipping goes whole, and a
+   '}' closing an outer block always stops.  past the error limit the
+   set is not looked at, so the rest of the block is dropped.
+   returns the sym stopped at, tEND at the end of the input.
+ */
+int skipto(const int *set) {
+    Token *t = cur_token();
+    int depth = 0, over = errors_over_limit();
+    const int *s;
+
+    while (true) {
+	if (depth == 0) {
+	    if (t->sym == '}') break;
+	    for (s = set; !over && *s && *s != t->sym; s++) ;
+	    if (!over && *s) break;
+	}
+	if (t->sym == '(' || t->sym == '{') depth++;
+	if ((t->sym == ')' || t->sym == '}') && depth > 0) depth--;
+	if (!gettoken()) { t->sym = tEND; break; }
     }
+    return t->sym;
 }
 
 static Token *gettoken0() {
     int ch;
-    Token *t = &tok;
+    Token *t = cur_token();
     t->index = 0;
 
     ch = nextch();
-    if (ch == EOF) { return (Token*)0; }
+    tell_scan(&t->no, &t->pos);
+    t->pos--;
+    if (ch == EOF) { t->no++; t->pos = 0; return (Token*)0; }
 
     switch (codeof(ch)) {
 	case '+': case '-': case '*': case'/': case '%':
@@ -93,7 +125,7 @@ static Token *gettoken0() {
 }
 
 static Token *id(int ch) {
-    Token *t = &tok;
+    Token *t = cur_token();
 
     outch(ch);
     while (1) {
@@ -120,7 +152,7 @@ static int hexval(int ch) {
 }
 
 static Token *op(int ch) {
-    Token *t = &tok;
+    Token *t = cur_token();
     int ch2;
     int s = 1;
 
@@ -228,7 +260,7 @@ static Token *op(int ch) {
 }
 
 static Token *op_eq(int ch) {
-    Token *t = &tok;
+    Token *t = cur_token();
 
     outch(ch);
     outch(0);
@@ -237,7 +269,7 @@ static Token *op_eq(int ch) {
 }
 
 static Token *op_dup(int ch) {
-    Token *t = &tok;
+    Token *t = cur_token();
 
     outch(ch);
     outch(0);
@@ -246,7 +278,7 @@ static Token *op_dup(int ch) {
 }
 
 static Token *lit(int ch) {
-    Token *t = &tok;
+    Token *t = cur_token();
     int d = 0;
     int v = 0;
     int b = 10;
@@ -296,7 +328,7 @@ static Token *lit(int ch) {
 }
 
 Token *flit(int ch) {
-    Token *t = &tok;
+    Token *t = cur_token();
     int ival = t->ival;
 
     outch(ch);
@@ -308,7 +340,7 @@ Token *flit(int ch) {
 }
 
 Token *clit(int ch) {
-    Token *t = &tok;
+    Token *t = cur_token();
     int v=0;
     while (1) {
 	ch = nextch();
@@ -323,7 +355,7 @@ Token *clit(int ch) {
 }
 
 Token *slit(int ch) {
-    Token *t = &tok;
+    Token *t = cur_token();
     while (1) {
 	ch = nextch();
 	if (ch == '\"') break;
@@ -341,7 +373,7 @@ Token *slit(int ch) {
 static int keep = 0;
 
 static Token *cmt(int ch) {
-    Token *t = &tok;
+    Token *t = cur_token();
     clear_lexeme();
 
     switch (ch) {
@@ -0,0 +1,592 @@
+//
+// sema.c -- semantic pass over a tree built with the checks deferred
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "token.h"
+#include "ast.h"
+#include "sym.h"
+#include "type.h"
+#include "frame.h"
+#include "context.h"
+#include "sema.h"
+
+/*
+   With defer_checks(true) the parsers only build the tree: references
+   are left unresolved and operators untyped.  check_SEMA() then takes
+   the tree in three steps.
+
+   plan   : the classes are walked and every function of a class (or the
+	    block of parser1) becomes a job, followed by a job for the
+	    record of the class.  Declarations are all known by now.
+	    check_member_SEMA() plans only a member read again.
+   check  : each function job is checked on its own, by one of the
+	    workers.  A worker keeps the names of the function in a stack
+	    of its own and falls back to the fields of the enclosing
+	    classes and the global symbols, which are only read.  Every
+	    nVREF is bound to its symbol, expressions are typed bottom up
+	    and calls are matched; the conversions found are kept in the
+	    job instead of being put in the tree.
+   apply  : in job order, the conversions are put in, the frames and
+	    records are laid out, and the diagnostics of all jobs are
+	    printed in source order.
+
+   Only the check step runs on more than one thread.  Nothing it calls
+   makes nodes, types or symbols, so the tables are shared as they are:
+   every worker binds the context of the caller.
+ */
+
+typedef struct name {
+    char *text;
+    int  sym;		/* symbol of a variable, 0 for a function */
+    AST  decl;		/* nFUNCDECL of a function */
+    int  link;		/* previous name in the same bucket */
+} name;
+
+typedef struct diag {
+    int  line, col;
+    int  job;
+    int  seq;
+    bool last;		/* the one at the error limit of its job */
+    char *msg;
+} diag;
+
+typedef struct conv {
+    AST a;		/* nOP2 */
+    int lc, rc;		/* conversions of its sons */
+    AST ty;
+} conv;
+
+typedef struct ctx {
+    AST cls;
+    int outer;		/* enclosing class, or -1 */
+} ctx;
+
+typedef struct job {
+    AST unit;		/* nFUNCDECL, or the root nBLOCK; 0 for a record */
+    int ctx;		/* innermost class */
+    AST vdl, fdl;	/* of a record */
+    conv *convs;
+    int conv_cnt, conv_max;
+    AST *bodies;	/* blocks to lay out, inner functions first */
+    int body_cnt, body_max;
+    diag *diags;
+    int diag_cnt, diag_max;
+} job;
+
+#define NAME_NBUCKET 256
+
+typedef struct worker {
+    name *names;
+    int name_cnt, name_max;
+    int bucket[NAME_NBUCKET];
+    job *jp;
+    int jno;
+    AST cur;		/* node being checked, for the diagnostics */
+} worker;
+
+/* one check_SEMA(), shared by its workers */
+typedef struct run {
+    Context *cx;	/* of the caller, bound by every worker */
+    ctx *ctxs;
+    int ctx_cnt, ctx_max;
+    job *jobs;
+    int job_cnt, job_max;
+    int next_job;
+    pthread_mutex_t job_lock;
+    AST int_type;
+} run;
+
+static int nthreads = 1;
+
+static __thread run *rn;
+static __thread worker *self;
+
+/* the number of workers for the check step */
+void threads_SEMA(int n) {
+    nthreads = (n > 0) ? n : 1;
+}
+
+static unsigned name_hash(char *s) {
+    unsigned h = 0;
+    while (*s) h = h * 31 + (unsigned char)*s++;
+    return h & (NAME_NBUCKET-1);
+}
+
+static void push_name(char *text, int sym, AST decl) {
+    worker *w = self;
+    name *np;
+    unsigned h;
+
+    if (text == 0) return;
+    if (w->name_cnt >= w->name_max) {
+	w->name_max = (w->name_max) ? w->name_max * 2 : 64;
+	w->names = (name *)realloc(w->names, w->name_max * sizeof(name));
+    }
+    h = name_hash(text);
+    np = &w->names[w->name_cnt];
+    np->text = text;
+    np->sym = sym;
+    np->decl = decl;
+    np->link = w->bucket[h];
+    w->bucket[h] = ++w->name_cnt;	/* 0 ends a chain */
+}
+
+static void pop_names(int mark) {
+    worker *w = self;
+    while (w->name_cnt > mark) {
+	name *np = &w->names[--w->name_cnt];
+	w->bucket[name_hash(np->text)] = np->link;
+    }
+}
+
+/* the innermost variable with the name, then the fields of the
+   enclosing classes, then the global symbols */
+static int lookup_name(char *text) {
+    worker *w = self;
+    AST decl;
+    int i;
+
+    for (i = w->bucket[name_hash(text)]; i; i = w->names[i-1].link) {
+	name *np = &w->names[i-1];
+	if (np->sym && strcmp(np->text, text) == 0) return np->sym;
+    }
+    for (i = w->jp->ctx; i >= 0; i = rn->ctxs[i].outer) {
+	decl = lookup_member_SYM(rn->ctxs[i].cls, text);
+	if (decl && nodetype(decl) == nVARDECL) return get_ival(get_son0(decl));
+    }
+    return lookup_SYM_all(text);
+}
+
+static void report(const char *msg) {
+    job *jp = self->jp;
+    diag *dp;
+
+    if (jp->diag_cnt >= jp->diag_max) {
+	jp->diag_max = (jp->diag_max) ? jp->diag_max * 2 : 16;
+	jp->diags = (diag *)realloc(jp->diags, jp->diag_max * sizeof(diag));
+    }
+    dp = &jp->diags[jp->diag_cnt];
+    dp->line = get_line(self->cur);
+    dp->col = get_col(self->cur);
+    dp->job = self->jno;
+    dp->seq = jp->diag_cnt++;
+    dp->last = false;
+    dp->msg = strdup(msg);
+}
+
+static void check(AST);
+
+static void check_list(AST l) {
+    AST e = 0;
+    while (l) {
+	get_sons(l, &e, &l, 0, 0);
+	if (e) check(e);
+    }
+}
+
+/* the functions of a block are visible from all of its statements */
+static void push_funcs(AST fdl) {
+    AST e = 0;
+    while (fdl) {
+	get_sons(fdl, &e, &fdl, 0, 0);
+	if (e && nodetype(e) == nFUNCDECL) push_name(get_text(get_son0(e)), 0, e);
+    }
+}
+
+static bool find_call(char *text, AST args) {
+    worker *w = self;
+    AST argdecls = 0;
+    int i;
+
+    for (i = w->bucket[name_hash(text)]; i; i = w->names[i-1].link) {
+	name *np = &w->names[i-1];
+	if (np->decl == 0 || strcmp(np->text, text) != 0) continue;
+	get_sons(np->decl, 0, 0, &argdecls, 0);
+	if (checkArgs(argdecls, args)) return true;
+    }
+    for (i = w->jp->ctx; i >= 0; i = rn->ctxs[i].outer)
+	if (checkFuncExistClass(rn->ctxs[i].cls, text, args)) return true;
+    return checkFuncExistAll(text, args);
+}
+
+static void check_call(AST a) {
+    AST recv = 0, fname = 0, args = 0, ty;
+
+    get_sons(a, &recv, &fname, &args, 0);
+    check_list(args);
+    self->cur = a;
+    if (recv) {
+	ty = gettype_SYM(lookup_name(get_text(recv)));
+	if (nodetype(ty) != tCLASS)
+	    parse_error("Symbol must be instance of a class");
+	else if (!checkFuncExistClass(ty, get_text(fname), args))
+	    parse_error("No defined functions of the class matches types of passed arguments");
+    } else if (!find_call(get_text(fname), args)) {
+	parse_error("No defined functions matches types of passed arguments");
+    }
+}
+
+static void check_index(AST exprs) {
+    AST e = 0;
+    while (exprs) {
+	get_sons(exprs, &e, &exprs, 0, 0);
+	if (e == 0) continue;
+	check(e);
+	self->cur = e;
+	if (typeof_AST(e) != rn->int_type) parse_error("Index of array must be integer");
+    }
+}
+
+/* the conversions are kept for apply_job(), the tree is not touched */
+static void check_op2(AST a, AST s0, AST s1) {
+    job *jp = self->jp;
+    conv *cp;
+    int lc, rc;
+    AST ty;
+
+    self->cur = a;
+    ty = opcheck2(get_ival(a), s0, s1, &lc, &rc);
+    set_exprtype(a, ty);
+    if (lc == 0 && rc == 0) return;
+
+    if (jp->conv_cnt >= jp->conv_max) {
+	jp->conv_max = (jp->conv_max) ? jp->conv_max * 2 : 16;
+	jp->convs = (conv *)realloc(jp->convs, jp->conv_max * sizeof(conv));
+    }
+    cp = &jp->convs[jp->conv_cnt++];
+    cp->a = a;
+    cp->lc = lc;
+    cp->rc = rc;
+    cp->ty = ty;
+}
+
+static void add_body(AST b) {
+    job *jp = self->jp;
+    if (jp->body_cnt >= jp->body_max) {
+	jp->body_max = (jp->body_max) ? jp->body_max * 2 : 4;
+	jp->bodies = (AST *)realloc(jp->bodies, jp->body_max * sizeof(AST));
+    }
+    jp->bodies[jp->body_cnt++] = b;
+}
+
+static void check(AST a) {
+    AST s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    int kind = nodetype(a), mark;
+
+    if (kind < nPROG || kind >= nEND) return;	/* types */
+    get_sons(a, &s0, &s1, &s2, &s3);
+    switch (kind) {
+	case nVAR:
+	    push_name(get_text(a), get_ival(a), 0);
+	    return;
+
+	case nVREF:
+	    self->cur = a;
+	    set_ival(a, lookup_name(get_text(a)));
+	    if (get_ival(a) == 0) parse_error("Undefined variable");
+	    return;
+
+	case nSTRUCT:	/* fields are out of scope, laid out by the parser */
+	    return;
+
+	case nFUNCDECL:
+	    mark = self->name_cnt;
+	    check(s2);
+	    check(s3);
+	    pop_names(mark);
+	    add_body(s3);
+	    return;
+
+	case nBLOCK:
+	    mark = self->name_cnt;
+	    if (nodetype(s1) == nFUNCDECLS) push_funcs(s1);
+	    check(s0); check(s1); check(s2);
+	    pop_names(mark);
+	    return;
+
+	case nOP2:
+	    check(s0); check(s1);
+	    check_op2(a, s0, s1);
+	    return;
+
+	case nOP0: case nOP1:
+	    check(s0);
+	    self->cur = a;
+	    set_exprtype(a, optype1(get_ival(a), s0));
+	    return;
+
+	case nLVAL:
+	    check(s0);
+	    check_index(s1);
+	    return;
+
+	case nASN:
+	    check(s0); check(s1);
+	    self->cur = a;
+	    if (s0 && s1 && !equaltype(s0, s1)) parse_error("Type missmatched");
+	    return;
+
+	case nCALL:
+	    check_call(a);
+	    return;
+
+	case nCLASSDECLS: case nSTRUCTS: case nVARDECLS:
+	case nFUNCDECLS: case nARGDECLS: case nARGS: case nSTMTS:
+	case nEXPRS: case nVARS:
+	    check_list(a);
+	    return;
+
+	default:
+	    check(s0); check(s1); check(s2); check(s3);
+	    return;
+    }
+}
+
+static int add_job(AST unit, int c) {
+    job *jp;
+    if (rn->job_cnt >= rn->job_max) {
+	rn->job_max = (rn->job_max) ? rn->job_max * 2 : 64;
+	rn->jobs = (job *)realloc(rn->jobs, rn->job_max * sizeof(job));
+    }
+    jp = &rn->jobs[rn->job_cnt];
+    memset(jp, 0, sizeof(job));
+    jp->unit = unit;
+    jp->ctx = c;
+    return rn->job_cnt++;
+}
+
+static int add_ctx(AST cls, int outer) {
+    if (rn->ctx_cnt >= rn->ctx_max) {
+	rn->ctx_max = (rn->ctx_max) ? rn->ctx_max * 2 : 16;
+	rn->ctxs = (ctx *)realloc(rn->ctxs, rn->ctx_max * sizeof(ctx));
+    }
+    rn->ctxs[rn->ctx_cnt].cls = cls;
+    rn->ctxs[rn->ctx_cnt].outer = outer;
+    return rn->ctx_cnt++;
+}
+
+/* a job per function of a class, then one for its record */
+static void plan(AST a, int outer) {
+    AST head = 0, body = 0, cdl = 0, vdl = 0, fdl = 0, l, e = 0;
+    int c;
+
+    switch (nodetype(a)) {
+	case nPROG:
+	    plan(get_son0(a), outer);
+	    break;
+	case nCLASSDECLS:
+	    while (a) {
+		get_sons(a, &e, &a, 0, 0);
+		if (e) plan(e, outer);
+	    }
+	    break;
+	case nCLASSDECL:
+	    get_sons(a, &head, &body, 0, 0);
+	    get_sons(body, 0, &cdl, &vdl, &fdl);
+	    c = add_ctx(get_son0(head), outer);
+
+	    if (cdl) plan(cdl, c);
+	    for (l = fdl; l; ) {
+		get_sons(l, &e, &l, 0, 0);
+		if (e) add_job(e, c);
+	    }
+	    c = add_job(0, c);
+	    rn->jobs[c].vdl = vdl;
+	    rn->jobs[c].fdl = fdl;
+	    break;
+	case nBLOCK:
+	    add_job(a, outer);
+	    break;
+	default:
+	    break;
+    }
+}
+
+/* the nCLASSDECL around a, or 0 */
+static AST outer_class(AST a) {
+    for (a = get_father(a); a && nodetype(a) != nCLASSDECL; a = get_father(a))
+	;
+    return a;
+}
+
+/* the contexts of the classes around classdecl, outermost first */
+static int plan_outer(AST classdecl) {
+    AST head = 0;
+    int outer;
+
+    if (classdecl == 0) return -1;
+    outer = plan_outer(outer_class(classdecl));
+    get_sons(classdecl, &head, 0, 0, 0);
+    return add_ctx(get_son0(head), outer);
+}
+
+/*
+   the jobs for a member read again : a class is planned as a whole, a
+   function with the function of its class holding it, whose names it
+   sees, followed by the record of that class.
+ */
+static void plan_member(AST a) {
+    AST f, cls, body = 0, vdl = 0, fdl = 0;
+    int c;
+
+    if (nodetype(a) == nCLASSDECL) {
+	plan(a, plan_outer(outer_class(a)));
+	return;
+    }
+    for (f = get_father(a); f && nodetype(f) != nCLASSDECL; f = get_father(f))
+	if (nodetype(f) == nFUNCDECL) a = f;
+    cls = outer_class(a);
+    c = plan_outer(cls);
+    add_job(a, c);
+    if (cls == 0) return;
+    get_sons(cls, 0, &body, 0, 0);
+    get_sons(body, 0, 0, &vdl, &fdl);
+    c = add_job(0, c);
+    rn->jobs[c].vdl = vdl;
+    rn->jobs[c].fdl = fdl;
+}
+
+static void run_job(int i) {
+    job *jp = &rn->jobs[i];
+
+    self->jp = jp;
+    self->jno = i;
+    self->name_cnt = 0;
+    memset(self->bucket, 0, sizeof(self->bucket));
+    check(jp->unit);
+    if (nodetype(jp->unit) == nBLOCK) add_body(jp->unit);
+}
+
+static void *work(void *arg) {
+    worker w;
+    int i;
+
+    memset(&w, 0, sizeof(w));
+    rn = (run *)arg;
+    use_context(rn->cx);
+    self = &w;
+    while (true) {
+	pthread_mutex_lock(&rn->job_lock);
+	i = rn->next_job++;
+	pthread_mutex_unlock(&rn->job_lock);
+	if (i >= rn->job_cnt) break;
+	if (rn->jobs[i].unit) run_job(i);
+    }
+    free(w.names);
+    self = 0;
+    return arg;
+}
+
+static void check_jobs() {
+    pthread_t *tids;
+    int i, n = nthreads;
+
+    rn->next_job = 0;
+    if (n > rn->job_cnt) n = rn->job_cnt;
+    if (n <= 1) {
+	work(rn);
+	return;
+    }
+    tids = (pthread_t *)malloc(n * sizeof(pthread_t));
+    for (i=0;i<n;i++) pthread_create(&tids[i], 0, work, rn);
+    for (i=0;i<n;i++) pthread_join(tids[i], 0);
+    free(tids);
+}
+
+/* conversions and layout, in the order of the source */
+static void apply_job(job *jp) {
+    AST l = 0, r = 0;
+    int i;
+
+    if (jp->unit == 0) {
+	layout_record(rn->ctxs[jp->ctx].cls, jp->vdl, jp->fdl);
+	return;
+    }
+    for (i=0;i<jp->conv_cnt;i++) {
+	conv *cp = &jp->convs[i];
+	get_sons(cp->a, &l, &r, 0, 0);
+	set_sons(cp->a, convert_type(l, cp->lc), convert_type(r, cp->rc), 0, 0);
+	set_exprtype(cp->a, cp->ty);
+    }
+    for (i=0;i<jp->body_cnt;i++) layout_frame(jp->bodies[i]);
+}
+
+static int by_position(const void *p1, const void *p2) {
+    const diag *d1 = p1, *d2 = p2;
+    if (d1->line != d2->line) return d1->line - d2->line;
+    if (d1->col != d2->col) return d1->col - d2->col;
+    if (d1->job != d2->job) return d1->job - d2->job;
+    return d1->seq - d2->seq;
+}
+
+/* every job is a unit for set_error_limit(), as a body read on its own */
+static int flush_diags() {
+    diag *all;
+    int i, j, n = 0, limit = get_error_limit();
+
+    for (i=0;i<rn->job_cnt;i++) {
+	job *jp = &rn->jobs[i];
+	if (limit && jp->diag_cnt >= limit) {
+	    for (j=limit;j<jp->diag_cnt;j++) free(jp->diags[j].msg);
+	    jp->diag_cnt = limit;
+	    jp->diags[limit-1].last = true;
+	}
+	n += jp->diag_cnt;
+    }
+    all = (diag *)malloc((n+1) * sizeof(diag));
+    for (i=n=0;i<rn->job_cnt;i++)
+	for (j=0;j<rn->jobs[i].diag_cnt;j++) all[n++] = rn->jobs[i].diags[j];
+    qsort(all, n, sizeof(diag), by_position);
+    for (i=0;i<n;i++) {
+	printf("ERROR: %s at line %d col %d\n", all[i].msg, all[i].line, all[i].col);
+	if (all[i].last) printf("ERROR: too many errors, the rest is not checked\n");
+	free(all[i].msg);
+    }
+    free(all);
+    return n;
+}
+
+/* the three steps over the tree at root, or over the member read again */
+static int check_run(AST root, AST member) {
+    run r;
+    int i, n;
+
+    memset(&r, 0, sizeof(r));
+    r.cx = cur_context();
+    pthread_mutex_init(&r.job_lock, 0);
+    rn = &r;
+    if (member) plan_member(member);
+    else plan(root, -1);
+
+    intern_types();
+    rn->int_type = make_AST_name("int");
+    set_error_hook(report);
+    check_jobs();
+    set_error_hook(0);
+
+    for (i=0;i<rn->job_cnt;i++) apply_job(&rn->jobs[i]);
+    n = flush_diags();
+    for (i=0;i<rn->job_cnt;i++) {
+	free(rn->jobs[i].convs);
+	free(rn->jobs[i].bodies);
+	free(rn->jobs[i].diags);
+    }
+    free(r.jobs);
+    free(r.ctxs);
+    pthread_mutex_destroy(&r.job_lock);
+    rn = 0;
+    return n;
+}
+
+/* resolve and type the tree at root, then print what was found wrong */
+int check_SEMA(AST root) {
+    return check_run(root, 0);
+}
+
+/* the same for a class or method put in by reparse(); the rest stays checked */
+int check_member_SEMA(AST member) {
+    return (member) ? check_run(0, member) : 0;
+}
@@ -0,0 +1,9 @@
+#ifndef _SEMA_H_
+#define _SEMA_H_
+#include "ast.h"
+
+int  check_SEMA(AST);
+int  check_member_SEMA(AST);
+void threads_SEMA(int);
+
+#endif
@@ -5,25 +5,129 @@
 #include "loc.h"
 #include "sym.h"
 #include "ast.h"
+#include "type.h"
+#include "token.h"
+
+/*
+   overload index : functions keyed by (name, arity).  each entry keeps
+   a hash of its argument types, so a call only runs checkArgs() on the
+   candidates whose signature hash matches.  an entry is visible while
+   the scope it was declared in is on the stack.
+ */
+typedef struct funcentry {
+    int  sym;
+    int  arity;
+    unsigned sig;
+    bool wild;		/* some arg has no type; always run checkArgs */
+    int  level;		/* scope_buf slot and id of the declaring scope */
+    int  id;
+    int  next;
+} funcentry;
+
+/*
+   class member tables : built by make_class_SYM() when a class body is
+   finished.  fields and methods of the class are kept in an open
+   addressing table keyed by name; methods with the same name are
+   chained, each with the arity and signature hash used for functions.
+ */
+typedef struct member {
+    char *name;
+    AST  decl;		/* nVARDECL or nFUNCDECL */
+    int  arity;
+    unsigned sig;
+    bool wild;
+    int  next;		/* older member with the same name */
+} member;
+
+typedef struct classentry {
+    AST  cls;		/* tCLASS node */
+    int  *hash;		/* newest member for each name */
+    int  hsize;
+} classentry;
+
+/*
+   constant pool : one cLOCAL entry per distinct literal, keyed by
+   (type, value) for int and char, and by (type, text) for float and
+   string.  the entries get no name; name_SYM() makes "$Cnnnn" from
+   the position in the pool when a name is needed for dumping.
+ */
+typedef struct conentry {
+    int  ty;
+    int  val;
+    char *text;
+    int  sym;
+} conentry;
+
+/* the tables of one context, see context.c */
+struct SYM_state {
+    symentry *symtab;
+    int symcnt;
+    int symmax;
+
+    /* scope stack : scope_buf[1] is the outermost, scope_buf[scope_cnt] is cur */
+    scope *scope_buf;
+    int scope_cnt;
+    int scope_max;
+    int scope_serial;
+    scope *cur;
+    int cur_depth;
+    int arg_mark;
+
+    funcentry *functab;
+    int func_cnt;
+    int func_max;
+    int *func_bucket;
+    int func_nbucket;
+
+    member *membtab;
+    int memb_cnt;
+    int memb_max;
+
+    classentry *classtab;
+    int class_cnt;
+    int class_max;
+    int *class_hash;		/* tCLASS node -> classtab */
+    int class_hsize;
+
+    conentry *contab;
+    int con_cnt;
+    int con_max;
+    int *con_hash;
+    int con_hsize;
+
+    int var_seq;
+    int con_seq;
+    int type_seq;
+    int func_seq;
+};
 
-static symentry *symtab;
-static int symcnt;
+static SYM_state main_state;
+static __thread SYM_state *st = &main_state;
 
-static scope *scope_buf;
-static int scope_cnt;
+SYM_state *new_SYM_state()   { return (SYM_state *)calloc(1, sizeof(SYM_state)); }
+void use_SYM(SYM_state *s)   { st = (s) ? s : &main_state; }
+SYM_state *cur_SYM()         { return st; }
 
-static int var_seq;
-static int con_seq;
-static int type_seq;
-static int func_seq;
-static bool obmitted[MAX_SYMENTRY] = {false};
+void free_SYM(SYM_state *s) {
+    int i;
+    for (i=1;i<=s->scope_cnt;i++) free(s->scope_buf[i].hash);
+    for (i=1;i<=s->class_cnt;i++) free(s->classtab[i].hash);
+    free(s->symtab);
+    free(s->scope_buf);
+    free(s->functab);
+    free(s->func_bucket);
+    free(s->membtab);
+    free(s->classtab);
+    free(s->class_hash);
+    free(s->contab);
+    free(s->con_hash);
+    if (s != &main_state) free(s);
+}
 
-static scope *cur = 0;
 static scope *new_scope();
-static int cur_depth = 0;
-inline void incr_depth() { ++cur_depth; }
-inline void decr_depth() { --cur_depth; }
-inline int get_cur_depth () { return cur_depth; }
+inline void incr_depth() { ++st->cur_depth; }
+inline void decr_depth() { --st->cur_depth; }
+inline int get_cur_depth () { return st->cur_depth; }
 
 char *gen(int kind) {
     char buf[10];
@@ -31,10 +135,10 @@ char *gen(int kind) {
     int c;
 
     switch (kind) {
-	case vLOCAL: p = &var_seq;  c = 'V'; break;        
-	case cLOCAL: p = &con_seq;  c = 'C'; break;        
-	case fLOCAL: p = &func_seq;  c = 'F'; break;        
-	case tGLOBAL: p = &type_seq;  c = 'T'; break;        
+	case vLOCAL: p = &st->var_seq;  c = 'V'; break;        
+	case cLOCAL: p = &st->con_seq;  c = 'C'; break;        
+	case fLOCAL: p = &st->func_seq;  c = 'F'; break;        
+	case tGLOBAL: p = &st->type_seq;  c = 'T'; break;        
 	default: break;
     }
     if (p) { 
@@ -46,88 +150,167 @@ char *gen(int kind) {
 
 void init_SYM() { 
     int sz;
-    sz  = (MAX_SYMENTRY+1) * sizeof(symentry);
-    symtab = (symentry *)malloc(sz);
-    bzero(symtab, sz);
-    symcnt = 0;
-
-    sz = (MAX_SCOPEENTRY+1) * sizeof(scope);
-    scope_buf = (scope *)malloc(sz);
-    bzero(scope_buf, sz);
-    scope_cnt = 0;
-
-    var_seq = 0;
-    con_seq = 0;
-    type_seq = 0;
+    st->symmax = MAX_SYMENTRY;
+    sz  = (st->symmax+1) * sizeof(symentry);
+    st->symtab = (symentry *)malloc(sz);
+    bzero(st->symtab, sz);
+    st->symcnt = 0;
+    st->func_cnt = 0;
+    if (st->func_bucket) bzero(st->func_bucket, st->func_nbucket * sizeof(int));
+    st->func_nbucket = 0;
+    st->con_cnt = 0;
+    if (st->con_hash) bzero(st->con_hash, st->con_hsize * sizeof(int));
+    st->memb_cnt = 0;
+    st->class_cnt = 0;
+    if (st->class_hash) bzero(st->class_hash, st->class_hsize * sizeof(int));
+
+    st->scope_max = MAX_SCOPEENTRY;
+    sz = (st->scope_max+1) * sizeof(scope);
+    st->scope_buf = (scope *)malloc(sz);
+    bzero(st->scope_buf, sz);
+    st->scope_cnt = 0;
+
+    st->var_seq = 0;
+    st->con_seq = 0;
+    st->type_seq = 0;
+
+    st->cur = new_scope();
+}
 
-    cur = new_scope();
+/* make room for entry k of symtab */
+static void grow_SYM(int k) {
+    int n = st->symmax;
+    if (k <= st->symmax) return;
+    while (k > n) n *= 2;
+    st->symtab = (symentry *)realloc(st->symtab, (n+1) * sizeof(symentry));
+    bzero(st->symtab + st->symmax + 1, (n - st->symmax) * sizeof(symentry));
+    st->symmax = n;
 }
 
+/* push a scope */
 static scope *new_scope() {
-    scope *sp = 0;
-    if (++scope_cnt < MAX_SCOPEENTRY) {
-	sp = &scope_buf[scope_cnt];
-	sp->begin = symcnt+1;
-	sp->end   = 0;
-    } else {
-	parse_error("too much scopes");
+    scope *sp;
+    if (st->scope_cnt+1 > st->scope_max) {
+	st->scope_max *= 2;
+	st->scope_buf = (scope *)realloc(st->scope_buf, (st->scope_max+1) * sizeof(scope));
     }
+    sp = &st->scope_buf[++st->scope_cnt];
+    sp->begin = st->symcnt+1;
+    sp->end   = 0;
+    sp->id    = ++st->scope_serial;
+    sp->hash  = 0;
+    sp->hsize = 0;
+    sp->hcnt  = 0;
     return sp;
 }
 
 void delete_scope(scope *sp) {
-    /* do nothing */
-    int i;
-    for (i = cur->begin; i <= cur->end; i++) {
-	obmitted[i] = true;
+    free(sp->hash);
+    sp->hash = 0;
+    sp->hsize = sp->hcnt = 0;
+}
+
+/*
+   each scope has an open addressing table from a name to the newest
+   entry with that name in the scope; older entries with the same name
+   (overloaded functions, args) are chained by symentry.link.
+ */
+static unsigned hash_str(char *s) {
+    unsigned h = 2166136261u;
+    while (*s) { h ^= (unsigned char)*s++; h *= 16777619u; }
+    return h;
+}
+
+static unsigned mix(unsigned h, unsigned v) {
+    h ^= v;
+    h *= 16777619u;
+    return h;
+}
+
+/* slot of name in sp->hash, or the empty slot where it would go */
+static int find_slot(scope *sp, char *name) {
+    unsigned mask = sp->hsize - 1;
+    unsigned i = hash_str(name) & mask;
+    int k;
+
+    while ((k = sp->hash[i]) != 0) {
+	if (strcmp(st->symtab[k].name, name) == 0) break;
+	i = (i + 1) & mask;
     }
+    return i;
 }
 
-void enter_block() {
-    scope *sp;
+static void grow_scope(scope *sp) {
+    int *old = sp->hash;
+    int  n = sp->hsize;
+    int  i;
 
-    ++cur_depth;
-    reset_offset();
-    sp = new_scope();
-    if (sp) {
-	sp->next = cur;
-	cur = sp;
-	reset_offset();
+    sp->hsize = (n) ? n * 2 : 8;
+    sp->hash = (int *)malloc(sp->hsize * sizeof(int));
+    bzero(sp->hash, sp->hsize * sizeof(int));
+    for (i=0;i<n;i++) {
+	if (old[i]) sp->hash[find_slot(sp, st->symtab[old[i]].name)] = old[i];
     }
+    free(old);
+}
+
+static void hash_insert(scope *sp, int k) {
+    symentry *ep = &st->symtab[k];
+    int i;
+
+    if (ep->name == 0) return;
+    if ((sp->hcnt+1) * 2 > sp->hsize) grow_scope(sp);
+    i = find_slot(sp, ep->name);
+    ep->link = sp->hash[i];
+    if (ep->link == 0) sp->hcnt++;
+    sp->hash[i] = k;
+}
+
+/* newest entry with the name in the scope */
+static int hash_lookup(scope *sp, char *name) {
+    if (sp->hsize == 0) return 0;
+    return sp->hash[find_slot(sp, name)];
 }
 
+void enter_block() {
+    ++st->cur_depth;
+    reset_offset();
+    st->cur = new_scope();
+}
+
+static void drop_funcs(int level);
+
+/* pop the scope; its entries stay in symtab, only its tables go */
 void leave_block() {
-    scope *tmp;
-    --cur_depth;
-    if (cur) {
-	tmp = cur->next;
-	delete_scope(cur);
-	cur = tmp;
+    --st->cur_depth;
+    if (st->scope_cnt > 1) {
+	drop_funcs(st->scope_cnt);
+	delete_scope(st->cur);
+	st->cur = &st->scope_buf[--st->scope_cnt];
     }
 }
 
-static int arg_mark = 0;
-void mark_args()   { arg_mark = symcnt; }
-void unmark_args() { arg_mark = cur->end; }
+void mark_args()   { st->arg_mark = st->symcnt; }
+void unmark_args() { st->arg_mark = st->cur->end; }
 
 int insert_SYM(char *name, int type, int prop, int val) {
-    int depth, offset,sz;
-    symentry *ep = &symtab[++symcnt];
+    int depth, offset,sz,al;
+    symentry *ep;
 
-    if (symcnt > MAX_SYMENTRY) {
-	parse_error("Too much symbols");
-	return 0;
-    }
+    grow_SYM(st->symcnt+1);
+    ep = &st->symtab[++st->symcnt];
 
-    cur->end = symcnt;
+    st->cur->end = st->symcnt;
     ep->name = name;
     ep->type = type;
     ep->prop = prop;
     ep->val  = val;
+    hash_insert(st->cur, st->symcnt);
 
     depth = get_cur_depth();
     offset = 0;
     sz = get_sizeoftype(type);
+    al = get_alignoftype(type);
 
     switch (prop) {
 	case tGLOBAL:
@@ -142,12 +325,15 @@ int insert_SYM(char *name, int type, int prop, int val) {
 
 	case vLOCAL:
 	    offset = get_var_offset();
-	    incr_var_offset(sz);
+	    offset = (offset + al-1) / al * al;
+	    incr_var_offset(offset - get_var_offset() + sz);
 	    goto do_lookup;
 
-	case vARG:
+	case vARG:	/* downwards from -4 */
 	    decr_arg_offset(sz);
 	    offset = get_arg_offset();
+	    offset = -((-offset + al-1) / al * al);
+	    decr_arg_offset(get_arg_offset() - offset);
 	    depth++;
 
 do_lookup:
@@ -159,136 +345,407 @@ do_lookup:
     }
 
     set_loc_entry(ep->loc, depth, offset, sz);
-    return symcnt;
+    return st->symcnt;
+}
+
+/* int and char constants keep their value, the others an offset in the strings */
+bool is_immediate_CON(int ty) { return ty == PRIM_INT || ty == PRIM_CHAR; }
+
+static unsigned con_key(int ty, int val, char *text) {
+    return (is_immediate_CON(ty)) ? mix(mix(2166136261u, ty), val) : mix(hash_str(text), ty);
+}
+
+static int con_slot(int ty, int val, char *text) {
+    unsigned mask = st->con_hsize - 1;
+    unsigned i = con_key(ty, val, text) & mask;
+    int k;
+    while ((k = st->con_hash[i]) != 0) {
+	conentry *cp = &st->contab[k];
+	if (cp->ty == ty && (is_immediate_CON(ty) ? cp->val == val : strcmp(cp->text, text) == 0))
+	    break;
+	i = (i + 1) & mask;
+    }
+    return i;
+}
+
+/* the pool entry of literal (ty, val or text), added on first use */
+int insert_CON(int ty, int val, char *text) {
+    conentry *cp;
+    int i, k;
+
+    if ((st->con_cnt+1) * 2 > st->con_hsize) {
+	int *old = st->con_hash, n = st->con_hsize;
+	st->con_hsize = (n) ? n * 2 : 64;
+	st->con_hash = (int *)malloc(st->con_hsize * sizeof(int));
+	bzero(st->con_hash, st->con_hsize * sizeof(int));
+	for (k=1;k<=st->con_cnt;k++) {
+	    cp = &st->contab[k];
+	    st->con_hash[con_slot(cp->ty, cp->val, cp->text)] = k;
+	}
+	free(old);
+    }
+    i = con_slot(ty, val, text);
+    if ((k = st->con_hash[i]) != 0) return st->contab[k].sym;
+
+    if (++st->con_cnt >= st->con_max) {
+	st->con_max = (st->con_max) ? st->con_max * 2 : 64;
+	st->contab = (conentry *)realloc(st->contab, st->con_max * sizeof(conentry));
+    }
+    cp = &st->contab[st->con_cnt];
+    cp->ty  = ty;
+    cp->val = val;
+    if (is_immediate_CON(ty)) {
+	cp->text = 0;
+	cp->sym  = insert_SYM(0, 0, cLOCAL, val); /* immediate */
+    } else {
+	cp->text = insert_STR(text);
+	cp->sym  = insert_SYM(0, ty, cLOCAL, get_STR_offset(cp->text));
+    }
+    st->con_hash[i] = st->con_cnt;
+    return cp->sym;
+}
+
+/* name of entry k; pool entries are named on demand */
+char *name_SYM(int k) {
+    symentry *ep = &st->symtab[k];
+    int lo = 1, hi = st->con_cnt;
+    char buf[16];
+
+    if (k == 0) return "";
+    if (ep->name) return ep->name;
+    if (ep->prop != cLOCAL) return "";
+
+    while (lo < hi) {	/* contab is in symtab order */
+	int m = (lo + hi) / 2;
+	if (st->contab[m].sym < k) lo = m+1; else hi = m;
+    }
+    sprintf(buf, "$C%04d", lo);
+    return ep->name = strdup(buf);
 }
 
 int lookup_cur(scope *sp, char *name) {
-    symentry *p, *bp, *ep;
     int i;
 
     if (sp == 0) return 0;  /* guard */
-    i = sp->end;
-    bp = &symtab[sp->begin];
-    ep = &symtab[sp->end];
-
-    /* search reverse order */
-    for( p = ep; p >= bp; --i,--p) {
-	if (p && !obmitted[i] && p->name && strcmp(p->name,name)==0) {
-	    symentry *ep = &symtab[i];
-	    if (ep && ep->prop != vARG) return i;
-
-	    /* effective args must be in [arg_mark, sp->end] */
-	    if (arg_mark <= i) return i;
-	}
+
+    /* newest first */
+    for (i = hash_lookup(sp, name); i; i = st->symtab[i].link) {
+	if (st->symtab[i].prop != vARG) return i;
+
+	/* effective args must be in [arg_mark, sp->end] */
+	if (st->arg_mark <= i) return i;
     }
     return 0;
 }
 
-bool checkFuncExistCur(scope *sp, char *name, AST args){
-    symentry *p, *bp, *ep;
-    int i;
+/* equaltype(x,y) implies sig_type(x) == sig_type(y) */
+static unsigned sig_type(AST ty) {
+    int id = get_compatid(ty);
+    return (id) ? id : ty;
+}
 
-    if (sp == 0) return 0;  /* guard */
-    i = sp->end;
-    bp = &symtab[sp->begin];
-    ep = &symtab[sp->end];
-
-    /* search reverse order */
-    for( p = ep; p >= bp; --i,--p) {
-	if (p && !obmitted[i] && p->name && strcmp(p->name,name)==0) {
-	    symentry *ep = &symtab[i];
-	    if (ep && ep->prop == fLOCAL){
-		AST argsDef = 0;
-		get_sons(gettype_SYM(i), 0, &argsDef, 0, 0);
-		if (checkArgs(argsDef, args)) return true;
-	    }
-	}
+/* arity and signature of an argdecl or arg list */
+static int sig_list(AST l, unsigned *sig, bool *wild) {
+    AST e = 0;
+    int n = 0;
+
+    *sig = 2166136261u;
+    *wild = false;
+    while (l) {
+	get_sons(l, &e, &l, 0, 0);
+	if (e == 0) break;
+	if (get_son0(e) == 0) *wild = true;
+	*sig = mix(*sig, sig_type(typeof_AST(get_son0(e))));
+	n++;
+    }
+    return n;
+}
+
+static unsigned func_hash(char *name, int arity) {
+    return mix(hash_str(name), arity);
+}
+
+static void rehash_func() {
+    int i, n = (st->func_nbucket) ? st->func_nbucket * 2 : 64;
+
+    st->func_bucket = (int *)realloc(st->func_bucket, n * sizeof(int));
+    st->func_nbucket = n;
+    for (i=0;i<n;i++) st->func_bucket[i] = -1;
+    for (i=0;i<st->func_cnt;i++) {
+	funcentry *fp = &st->functab[i];
+	int b = func_hash(st->symtab[fp->sym].name, fp->arity) & (n-1);
+	fp->next = st->func_bucket[b];
+	st->func_bucket[b] = i;
+    }
+}
+
+/* add function k to the index, once its args are known */
+void register_func_SYM(int k) {
+    funcentry *fp;
+    AST args = 0;
+    int b;
+
+    if (k == 0 || st->symtab[k].name == 0) return;
+    if (st->func_cnt >= st->func_max) {
+	st->func_max = (st->func_max) ? st->func_max * 2 : 64;
+	st->functab = (funcentry *)realloc(st->functab, st->func_max * sizeof(funcentry));
+    }
+    if (st->func_cnt >= st->func_nbucket) rehash_func();
+
+    get_sons(gettype_SYM(k), 0, &args, 0, 0);
+    fp = &st->functab[st->func_cnt];
+    fp->sym   = k;
+    fp->arity = sig_list(args, &fp->sig, &fp->wild);
+    fp->level = st->scope_cnt;
+    fp->id    = st->cur->id;
+
+    b = func_hash(st->symtab[k].name, fp->arity) & (st->func_nbucket-1);
+    fp->next = st->func_bucket[b];
+    st->func_bucket[b] = st->func_cnt++;
+}
+
+/*
+   unlink the functions declared in scope level and deeper.  they are
+   the newest entries, and the newest entry of a bucket is its head.
+ */
+static void drop_funcs(int level) {
+    while (st->func_cnt > 0 && st->functab[st->func_cnt-1].level >= level) {
+	funcentry *fp = &st->functab[--st->func_cnt];
+	st->func_bucket[func_hash(st->symtab[fp->sym].name, fp->arity) & (st->func_nbucket-1)] = fp->next;
+    }
+}
+
+/* a function matching name and args, declared in scopes [lo, scope_cnt] */
+static bool find_func(char *name, AST args, int lo) {
+    unsigned sig;
+    bool wild;
+    int arity, e;
+
+    if (st->func_nbucket == 0) return false;
+    arity = sig_list(args, &sig, &wild);
+    for (e = st->func_bucket[func_hash(name, arity) & (st->func_nbucket-1)]; e >= 0; e = st->functab[e].next) {
+	funcentry *fp = &st->functab[e];
+	AST argsDef = 0;
+
+	if (fp->arity != arity) continue;
+	if (!fp->wild && !wild && fp->sig != sig) continue;
+	if (fp->level < lo || fp->level > st->scope_cnt || st->scope_buf[fp->level].id != fp->id) continue;
+	if (strcmp(st->symtab[fp->sym].name, name) != 0) continue;
+
+	get_sons(gettype_SYM(fp->sym), 0, &argsDef, 0, 0);
+	if (checkArgs(argsDef, args)) return true;
     }
     return false;
 }
 
 bool checkFuncExist(char *name, AST args){
-    return checkFuncExistCur(cur, name, args);
+    return find_func(name, args, st->scope_cnt);
 }
 
 bool checkFuncExistAll(char *name, AST args){
-    scope *sp;
-    for (sp = cur; sp; sp = sp->next){
-	if (checkFuncExistCur(sp, name, args)) return true;
+    return find_func(name, args, 1);
+}
+
+static int find_class(AST cls) {
+    unsigned i;
+    int k;
+    if (st->class_hsize == 0) return 0;
+    for (i = cls & (st->class_hsize-1); (k = st->class_hash[i]) != 0; i = (i+1) & (st->class_hsize-1)) {
+	if (st->classtab[k].cls == cls) return k;
     }
-    return false;
+    return 0;
 }
 
-bool checkFuncExistClass(AST class, char *name, AST args){
-    AST classDecl = get_father(get_father(class));
-    AST classBody = 0;
-    get_sons(classDecl, 0, &classBody, 0, 0);
-    if (classBody){
-    	AST funcdecls = 0;
-	get_sons(classBody, 0, 0, 0, &funcdecls);
-	while  (funcdecls){
-	    AST funcdecl = 0;
-	    get_sons(funcdecls, &funcdecl, &funcdecls, 0, 0);
-	    if (funcdecl){
-		AST namedecl = 0, argdecls = 0;
-		get_sons(funcdecl, &namedecl, 0, &argdecls, 0);
-		if (strncmp(get_text(namedecl), name, 100) == 0 && checkArgs(argdecls, args, 100)) return true;
-	    }
+static void insert_class(int k) {
+    unsigned i;
+    if ((st->class_cnt+1) * 2 > st->class_hsize) {
+	int j, n = (st->class_hsize) ? st->class_hsize * 2 : 16;
+	free(st->class_hash);
+	st->class_hash = (int *)malloc(n * sizeof(int));
+	bzero(st->class_hash, n * sizeof(int));
+	st->class_hsize = n;
+	for (j=1;j<k;j++) insert_class(j);
+    }
+    for (i = st->classtab[k].cls & (st->class_hsize-1); st->class_hash[i]; i = (i+1) & (st->class_hsize-1))
+	;
+    st->class_hash[i] = k;
+}
+
+static int member_slot(classentry *cp, char *name) {
+    unsigned mask = cp->hsize - 1;
+    unsigned i = hash_str(name) & mask;
+    int k;
+    while ((k = cp->hash[i]) != 0) {
+	if (strcmp(st->membtab[k].name, name) == 0) break;
+	i = (i + 1) & mask;
+    }
+    return i;
+}
+
+static void add_member(classentry *cp, AST decl, AST name, AST args) {
+    member *mp;
+    int i;
+
+    if (name == 0) return;
+    if (++st->memb_cnt >= st->memb_max) {
+	st->memb_max = (st->memb_max) ? st->memb_max * 2 : 64;
+	st->membtab = (member *)realloc(st->membtab, st->memb_max * sizeof(member));
+    }
+    mp = &st->membtab[st->memb_cnt];
+    mp->name = get_text(name);
+    mp->decl = decl;
+    mp->arity = (args) ? sig_list(args, &mp->sig, &mp->wild) : 0;
+    i = member_slot(cp, mp->name);
+    mp->next = cp->hash[i];
+    cp->hash[i] = st->memb_cnt;
+}
+
+static int count_list(AST l) {
+    AST e = 0;
+    int n = 0;
+    while (l) {
+	get_sons(l, &e, &l, 0, 0);
+	if (e) n++;
+    }
+    return n;
+}
+
+/* build the member table of a finished nCLASSDECL, again if it was changed */
+void make_class_SYM(AST classdecl) {
+    classentry *cp;
+    AST head = 0, body = 0, vdl = 0, fdl = 0, e = 0, name = 0, args = 0;
+    bool fresh = false;
+    int n, k;
+
+    get_sons(classdecl, &head, &body, 0, 0);
+    get_sons(body, 0, 0, &vdl, &fdl);
+    if (head == 0 || get_son0(head) == 0) return;
+
+    if ((k = find_class(get_son0(head))) != 0) {
+	cp = &st->classtab[k];
+	free(cp->hash);
+    } else {
+	if (++st->class_cnt >= st->class_max) {
+	    st->class_max = (st->class_max) ? st->class_max * 2 : 16;
+	    st->classtab = (classentry *)realloc(st->classtab, st->class_max * sizeof(classentry));
 	}
+	k = st->class_cnt;
+	fresh = true;
+	cp = &st->classtab[k];
+	cp->cls = get_son0(head);
+    }
+    n = count_list(vdl) + count_list(fdl);
+    for (cp->hsize = 8; cp->hsize < n * 2; cp->hsize *= 2)
+	;
+    cp->hash = (int *)malloc(cp->hsize * sizeof(int));
+    bzero(cp->hash, cp->hsize * sizeof(int));
+
+    while (vdl) {
+	get_sons(vdl, &e, &vdl, 0, 0);
+	if (e) add_member(cp, e, get_son0(e), 0);
+    }
+    while (fdl) {
+	get_sons(fdl, &e, &fdl, 0, 0);
+	if (e == 0) continue;
+	get_sons(e, &name, 0, &args, 0);
+	add_member(cp, e, name, args);
+    }
+    if (fresh) insert_class(k);
+}
+
+/* newest field or method of the class with the name */
+AST lookup_member_SYM(AST cls, char *name) {
+    classentry *cp;
+    int k = find_class(cls);
+    if (k == 0) return 0;
+    cp = &st->classtab[k];
+    k = cp->hash[member_slot(cp, name)];
+    return (k) ? st->membtab[k].decl : 0;
+}
+
+bool checkFuncExistClass(AST class, char *name, AST args){
+    classentry *cp;
+    unsigned sig;
+    bool wild;
+    int k, arity;
+
+    if ((k = find_class(class)) == 0) return false;
+    cp = &st->classtab[k];
+    arity = sig_list(args, &sig, &wild);
+    for (k = cp->hash[member_slot(cp, name)]; k; k = st->membtab[k].next) {
+	member *mp = &st->membtab[k];
+	AST argdecls = 0;
+
+	if (nodetype(mp->decl) != nFUNCDECL) continue;
+	if (mp->arity != arity) continue;
+	if (!mp->wild && !wild && mp->sig != sig) continue;
+	get_sons(mp->decl, 0, 0, &argdecls, 0);
+	if (checkArgs(argdecls, args)) return true;
     }
     return false;
 }
 
 int lookup_SYM_all(char *name) {
-    scope *sp;
-    int idx;
-    for (sp = cur; sp; sp = sp->next) {
-	if (idx = lookup_cur(sp,name)) 
+    int i, idx;
+    for (i = st->scope_cnt; i > 0; i--) {
+	if ((idx = lookup_cur(&st->scope_buf[i],name)) != 0)
 	    return idx;
     }
     return 0;
 }
 
+int count_SYM() { return st->symcnt; }
+
 int lookup_SYM(char *name) {
     int idx;
-    if (idx = lookup_cur(cur,name)) return idx;
+    if ((idx = lookup_cur(st->cur,name)) != 0) return idx;
     return 0;
 }
 
 int getval_SYM(int k) {
-    symentry *ep = &symtab[k];
+    symentry *ep = &st->symtab[k];
     return (k) ? ep->val : 0;
 }
 
 int getloc_SYM(int k) {
-    symentry *ep = &symtab[k];
+    symentry *ep = &st->symtab[k];
     return (k) ? ep->loc : 0;
 }
 
+void setloc_SYM(int k, int loc) {
+    symentry *ep = &st->symtab[k];
+    if (k) ep->loc = loc;
+}
+
+int getprop_SYM(int k) {
+    symentry *ep = &st->symtab[k];
+    return (k) ? ep->prop : 0;
+}
+
 int getdepth_SYM(int k) {
-    symentry *ep = &symtab[k];
+    symentry *ep = &st->symtab[k];
     int loc= (k) ? ep->loc : 0;
     return getdepth_LOC(loc); 
 }
 
 int getoffset_SYM(int k) {
-    symentry *ep = &symtab[k];
+    symentry *ep = &st->symtab[k];
     int loc= (k) ? ep->loc : 0;
     return getoffset_LOC(loc); 
 }
 
 void setval_SYM(int k, int val) {
-    symentry *ep = &symtab[k];
+    symentry *ep = &st->symtab[k];
     if (k) ep->val = val;
 }
 
 void setprop_SYM(int k, int prop) {
-    symentry *ep = &symtab[k];
+    symentry *ep = &st->symtab[k];
     if (k) ep->prop = prop;
 }
 
 int gettype_SYM(int k) {
-    symentry *ep = &symtab[k];
+    symentry *ep = &st->symtab[k];
     return (k)? ep->type : 0;
 }
 
@@ -298,6 +755,7 @@ static char *namestr[] = {
     "cLOCAL", "cGLOBAL",
     "tLOCAL", "tGLOBAL",
     "vARG",
+    "xDEAD",
     0
 };
 
@@ -306,12 +764,77 @@ static char *propname(int prop) {
     return namestr[prop-vLOCAL];
 }
 
+/* remove slot i from a linear probing table, moving later entries back */
+static void unslot(int *tab, int size, unsigned i, unsigned (*home)(int)) {
+    unsigned mask = size - 1;
+    unsigned j = i, h;
+
+    tab[i] = 0;
+    while (true) {
+	j = (j + 1) & mask;
+	if (tab[j] == 0) break;
+	h = home(tab[j]) & mask;
+	if ((j > i) ? (h <= i || h > j) : (h <= i && h > j)) {
+	    tab[i] = tab[j];
+	    tab[j] = 0;
+	    i = j;
+	}
+    }
+}
+
+static unsigned sym_home(int k)   { return hash_str(st->symtab[k].name); }
+
+/* take entry k out of the table of scope sp; k is the newest entry */
+static void unhash(scope *sp, int k) {
+    symentry *ep = &st->symtab[k];
+    int i;
+
+    if (ep->name == 0 || sp->hsize == 0) return;
+    i = find_slot(sp, ep->name);
+    if (sp->hash[i] != k) return;
+    if (ep->link) {
+	sp->hash[i] = ep->link;
+    } else {
+	unslot(sp->hash, sp->hsize, i, sym_home);
+	sp->hcnt--;
+    }
+}
+
+/*
+   entry k was made for a subtree that has been replaced : it keeps its
+   number, but is no longer found by name.  constants are shared and
+   stay.  this is the only way an entry goes; the table is not rolled
+   back, parser2 tells a vardecl from a funcdecl by lookahead instead.
+ */
+void retire_SYM(int k) {
+    symentry *ep = &st->symtab[k];
+    scope *sp;
+    int i, j;
+
+    if (k <= 0 || k > st->symcnt || ep->prop == cLOCAL) return;
+    for (i = st->scope_cnt; ep->name && i > 0; i--) {
+	sp = &st->scope_buf[i];
+	if (sp->hsize == 0) continue;
+	if (sp->hash[find_slot(sp, ep->name)] == k) {
+	    unhash(sp, k);
+	    break;
+	}
+	for (j = sp->hash[find_slot(sp, ep->name)]; j; j = st->symtab[j].link)
+	    if (st->symtab[j].link == k) break;
+	if (j) {
+	    st->symtab[j].link = ep->link;
+	    break;
+	}
+    }
+    ep->prop = xDEAD;
+}
+
 void dump_SYM(FILE *fp) {
     int i;
-    symentry *ep = &symtab[1];
-    fprintf(fp, "SYM:cnt=%d\n", symcnt);
-    for (i=1;i<=symcnt;i++, ep++) {
-	fprintf(fp, "%4d:%-10s %4d %8s %4d %4d\n", i, ep->name, ep->type, 
+    symentry *ep = &st->symtab[1];
+    fprintf(fp, "SYM:cnt=%d\n", st->symcnt);
+    for (i=1;i<=st->symcnt;i++, ep++) {
+	fprintf(fp, "%4d:%-10s %4d %8s %4d %4d\n", i, name_SYM(i), ep->type, 
 		propname(ep->prop), ep->val, ep->loc);
     }
     fprintf(fp, "\n");
@@ -329,14 +852,16 @@ int restore_SYM(FILE *fp) {
     int i,k;
     char text[40];
     char prop[10];
-    symentry *ep = &symtab[1];
-    fscanf(fp, "\nSYM:cnt=%d\n", &symcnt);
-    for (i=1;i<=symcnt;i++, ep++) {
+    symentry *ep;
+    fscanf(fp, "\nSYM:cnt=%d\n", &st->symcnt);
+    grow_SYM(st->symcnt);
+    ep = &st->symtab[1];
+    for (i=1;i<=st->symcnt;i++, ep++) {
 	bzero(text,40); bzero(prop,10);
 	fscanf(fp, "%d:%s %d %s %d %d\n", &k, 
 		text, &(ep->type), prop, &(ep->val),&(ep->loc));
 	ep->prop = propval(prop);
 	ep->name = strdup(text);
     }
-    return symcnt;
+    return st->symcnt;
 }
@@ -1,6 +1,8 @@
 #ifndef _SYM_H_
 #define _SYM_H_
+#include "ast.h"
 
+/* initial sizes, the tables grow on demand */
 #define MAX_SYMENTRY 1000
 #define MAX_SCOPEENTRY 100
 
@@ -10,6 +12,7 @@ enum {
     cLOCAL, cGLOBAL, 	  /* constants */
     tLOCAL, tGLOBAL,	  /* datatypes (classes) */
     vARG,
+    xDEAD,		  /* see retire_SYM() */
     pEND
 };
 
@@ -19,23 +22,50 @@ typedef struct {
     int  prop;
     int  val;
     int  loc;
+    int  link;	/* previous entry with the same name in the scope */
 } symentry ;
 
 typedef struct scope {
-    struct scope *next;
     int begin;
     int end;
+    int id;	/* serial number, tells a reused slot apart */
+    int *hash;	/* open addressing, newest entry for each name */
+    int hsize;
+    int hcnt;
 } scope;
 
+/* the tables of one context, see context.h */
+typedef struct SYM_state SYM_state;
+SYM_state *new_SYM_state(void);
+void use_SYM(SYM_state *);
+SYM_state *cur_SYM(void);
+void free_SYM(SYM_state *);
+
 void init_SYM();
 int insert_SYM(char*,int,int,int);
+int insert_CON(int,int,char*);
+bool is_immediate_CON(int);
+char *name_SYM(int);
 int lookup_SYM(char*);
 int lookup_SYM_all(char*);
+int count_SYM(void);
+void retire_SYM(int);
 
 void setval_SYM(int,int);
 void setprop_SYM(int,int);
 int  getval_SYM(int);
 int  gettype_SYM(int);
+int  getprop_SYM(int);
+int  getloc_SYM(int);
+void setloc_SYM(int,int);
+int  getdepth_SYM(int);
+
+void register_func_SYM(int);
+bool checkFuncExist(char*,AST);
+bool checkFuncExistAll(char*,AST);
+bool checkFuncExistClass(AST,char*,AST);
+void make_class_SYM(AST);
+AST  lookup_member_SYM(AST,char*);
 
 void enter_block(void);
 void leave_block(void);
@@ -5,39 +5,212 @@
 #include "type.h"
 #include "token.h"
 
-Token tok;
-Line line;
+/* the token source of one context, see context.c */
+struct TOK_state {
+    Token tok;		/* current token */
+    Line  line;
+    FILE  *in;		/* stdin if 0 */
+    char  *s_buf;	/* string pool */
+    char  *s_ptr;
+    char  *s_limit;
+    char  tmp[4];
+    int   prev_error_line_no;
+    int   error_cnt;	/* of this unit, see reset_errors() */
+    void  (*error_hook)(const char *);
+    FILE  *err;		/* diagnostics, stdout if 0 */
+    int   keep;		/* lines read are kept in src */
+    char  *src;
+    int   src_len, src_max;
+    int   *line_off;	/* line no -> offset in src */
+    int   line_cnt, line_max;
+    int   reread;	/* next line to take from src, 0 if from in */
+    int   shared;	/* src is lent by another context */
+    Token ahead[LOOKAHEAD];	/* read past tok by peek() */
+    Line  ahead_line[LOOKAHEAD];	/* line as it was after each of them */
+    int   ahead_first, ahead_cnt;
+    Line  seen;		/* line as it was after tok, while ahead_cnt */
+};
+
+static TOK_state main_state;
+static int error_limit = 20;	/* see set_error_limit() */
+static __thread TOK_state *st = &main_state;
+
+TOK_state *new_TOK_state()   { return (TOK_state *)calloc(1, sizeof(TOK_state)); }
+void use_TOK(TOK_state *s)   { st = (s) ? s : &main_state; }
+TOK_state *cur_TOK()         { return st; }
+Token *cur_token()           { return &st->tok; }
+
+void free_TOK(TOK_state *s) {
+    free(s->s_buf);
+    if (!s->shared) {
+	free(s->src);
+	free(s->line_off);
+    }
+    if (s != &main_state) free(s);
+}
+
+/* read the source from fp from now on */
+void set_input(FILE *fp) { st->in = fp; }
+
+/* keep the lines read from now on, so seek_input() can go back to them */
+void keep_input(int on) { st->keep = on; }
+
+/* read the lines kept by from, which must outlive this context */
+void share_input(TOK_state *from) {
+    st->src = from->src;
+    st->src_len = from->src_len;
+    st->line_off = from->line_off;
+    st->line_cnt = from->line_cnt;
+    st->keep = 0;
+    st->shared = 1;
+}
+
+static void grow_lines(int no) {
+    if (no < st->line_max) return;
+    while (no >= st->line_max)
+	st->line_max = (st->line_max) ? st->line_max * 2 : 1024;
+    st->line_off = (int *)realloc(st->line_off, st->line_max * sizeof(int));
+}
+
+/* copy len bytes of a line to the end of src, NUL added; returns where */
+static int add_src(char *buf, int len) {
+    int off = st->src_len;
+
+    if (st->src_len + len + 1 > st->src_max) {
+	st->src_max = (st->src_max) ? st->src_max * 2 : 65536;
+	if (st->src_max < st->src_len + len + 1) st->src_max = st->src_len + len + 1;
+	st->src = (char *)realloc(st->src, st->src_max);
+    }
+    memcpy(st->src + off, buf, len);
+    st->src[off + len] = 0;
+    st->src_len += len + 1;
+    return off;
+}
+
+static void keep_line(int no, char *buf) {
+    grow_lines(no);
+    st->line_off[no] = add_src(buf, strlen(buf));
+    st->line_cnt = no;
+}
+
+/*
+   put the lines of text in place of the cnt kept lines from no on; the
+   lines after them are renumbered.  returns the change in line count.
+ */
+int edit_input(int no, int cnt, char *text) {
+    char *s, *e;
+    int n = 0, d, i;
+
+    if (no + cnt > st->line_cnt + 1) cnt = st->line_cnt + 1 - no;
+    for (s = text; *s; s = e) {
+	e = strchr(s, '\n');
+	e = (e) ? e+1 : s + strlen(s);
+	n++;
+    }
+    d = n - cnt;
+    grow_lines(st->line_cnt + d + 1);
+    memmove(&st->line_off[no+n], &st->line_off[no+cnt], (st->line_cnt - (no+cnt) + 1) * sizeof(int));
+    st->line_cnt += d;
+    for (s = text, i = no; *s; s = e, i++) {
+	e = strchr(s, '\n');
+	e = (e) ? e+1 : s + strlen(s);
+	st->line_off[i] = add_src(s, e - s);
+    }
+    return d;
+}
+
+static char *reread_line(char *buf) {
+    if (st->reread > st->line_cnt) return 0;
+    return strcpy(buf, st->src + st->line_off[st->reread++]);
+}
+
+/* the line as the parser has it : tokens peeked at are not read yet */
+static Line *at() {
+    return (st->ahead_cnt) ? &st->seen : &st->line;
+}
+
+/* where the next character will be read */
+void tell_input(int *no, int *pos) {
+    *no = at()->no;
+    *pos = at()->pos;
+}
 
-int getlineno()  { return line.no; }
-int getlinepos() { return line.pos; }
+/* where the scanner is, ahead of tell_input() by the tokens peeked at */
+void tell_scan(int *no, int *pos) {
+    *no = st->line.no;
+    *pos = st->line.pos;
+}
+
+/* the i-th token peeked at past tok, 0 if not read yet */
+Token *ahead(int i) {
+    return (i < st->ahead_cnt) ? &st->ahead[(st->ahead_first + i) % LOOKAHEAD] : 0;
+}
+
+/* tok was just scanned past the one in *cur : it is kept and *cur put back */
+void push_ahead(Token *cur) {
+    int i = (st->ahead_first + st->ahead_cnt) % LOOKAHEAD;
 
-void clear_lexeme() { tok.index = 0; }
-void delete_prev() { --tok.index; }
-void outch(int ch) { tok.text[tok.index++] = ch; }
-int  prevch() { return (tok.index>0) ? (tok.text[tok.index-1]) : '\n'; }
+    if (st->ahead_cnt++ == 0) st->seen = st->line;
+    st->ahead[i] = st->tok;
+    st->ahead_line[i] = st->line;
+    st->tok = *cur;
+}
+
+/* the first token peeked at becomes tok; 0 at the end of the input */
+Token *pop_ahead() {
+    Token *t = &st->ahead[st->ahead_first];
 
-static char *s_buf;
-static char *s_ptr;
-static char *s_limit;
+    st->seen = st->ahead_line[st->ahead_first];
+    st->ahead_first = (st->ahead_first + 1) % LOOKAHEAD;
+    st->ahead_cnt--;
+    if (t->sym == tEND) {	/* gettoken() makes tok tEND */
+	st->tok.no = t->no;
+	st->tok.pos = t->pos;
+	return 0;
+    }
+    st->tok = *t;
+    return &st->tok;
+}
+
+/* go back to a place given by tell_input() in a kept line */
+void seek_input(int no, int pos) {
+    Line *p = &st->line;
+
+    strcpy(p->buf, st->src + st->line_off[no]);
+    p->no = no;
+    p->pos = pos;
+    p->backed = 0;
+    st->reread = no + 1;
+    st->ahead_cnt = 0;
+}
+
+int getlineno()  { return at()->no; }
+int getlinepos() { return at()->pos; }
+
+void clear_lexeme() { st->tok.index = 0; }
+void delete_prev() { --st->tok.index; }
+void outch(int ch) { st->tok.text[st->tok.index++] = ch; }
+int  prevch() { return (st->tok.index>0) ? (st->tok.text[st->tok.index-1]) : '\n'; }
 
 char *insert_STR(char *s) {
     int i;
     int len = strlen(s);
     char *p;
-    for (p=s_ptr, i=0; i<len && p<s_limit; i++)
+    for (p=st->s_ptr, i=0; i<len && p<st->s_limit; i++)
         p[i] = *s++;
     p[i++] = 0;
-    s_ptr += i;
+    st->s_ptr += i;
     return p;
 }
 
-inline int get_STR_offset(char *p) { return p - s_buf; }
+inline int get_STR_offset(char *p) { return p - st->s_buf; }
+char *get_STR(int off) { return st->s_buf + off; }
 
 void dump_STR(FILE *fp) {
     char *s;
     int i = 0;
-    fprintf(fp,"STR:cnt=%d", s_ptr - s_buf);
-    for (s=s_buf; s < s_ptr; s++) {
+    fprintf(fp,"STR:cnt=%d", st->s_ptr - st->s_buf);
+    for (s=st->s_buf; s < st->s_ptr; s++) {
         if (i++%16 == 0) fprintf(fp,"\n");
         fprintf(fp,"%02x ", *s);
     }
@@ -45,37 +218,43 @@ void dump_STR(FILE *fp) {
 }
 
 void initline() {
-    line.pos = 0;
-    line.no = 0;
-    line.backed = 0;
-    line.buf[line.pos] = '\n'; /* dummy */
+    st->ahead_cnt = 0;
+    st->line.pos = 0;
+    st->line.no = 0;
+    st->line.backed = 0;
+    st->line.buf[st->line.pos] = '\n'; /* dummy */
 
-    s_ptr = s_buf = malloc(MAX_STR_BUF);
-    s_limit = s_buf + MAX_STR_BUF-1;
-    *s_ptr = 0;
+    st->s_ptr = st->s_buf = malloc(MAX_STR_BUF);
+    st->s_limit = st->s_buf + MAX_STR_BUF-1;
+    *st->s_ptr = 0;
 }
 
 int nextch() {
-    Line *p = &line;
+    Line *p = &st->line;
     char *r;
     int ch;
 
     if ((ch = p->backed) != 0) {
             p->backed = 0;
+    } else if ((ch = p->buf[p->pos]) == EOF) {
+	    return EOF;		/* and again, it stays there */
     } else {
-	    ch = p->buf[p->pos++];
-	    if (ch == '\n') {
+	    p->pos++;
+	    if (ch == '\n' || ch == 0) {	/* 0 : the last line has no '\n' */
+		ch = '\n';
 		p->pos = 0;
-		r = fgets(p->buf,MAX_LINE,stdin);
+		if (st->reread) r = reread_line(p->buf);
+		else r = fgets(p->buf,MAX_LINE,(st->in) ? st->in : stdin);
 		if (r == 0) { p->buf[0] = EOF; return EOF; }
 		++p->no;
+		if (st->keep && !st->reread) keep_line(p->no, p->buf);
 	    }
     }
     return ch;
 }
 
 void backch(int ch) {
-    Line *p = &line;
+    Line *p = &st->line;
     if (p->pos > 0) {
        p->buf[--p->pos] = ch;
        p->backed = 0;
@@ -84,8 +263,6 @@ void backch(int ch) {
     }
 }
 
-static char tmp[4];
-
 static char *tokenname[] = {
   "ID", "ILIT", "CLIT", "FLIT", "SLIT",
   "ARIOP", "RELOP", "LOGOP", "ASNOP", "CMT",
@@ -97,22 +274,64 @@ static char *tokenname[] = {
 
 static char *nameof(int sym) {
     if (sym < ID) 
-         { tmp[0] = sym; tmp[1] = 0; return tmp; }
+         { st->tmp[0] = sym; st->tmp[1] = 0; return st->tmp; }
     else  if (sym < tEND)
          return tokenname[sym-ID];
     else
          return ""; 
 }
 
-static int prev_error_line_no = 0;
+
+/* send diagnostics to f instead of stdout, or back with 0 */
+void set_error_hook(void (*f)(const char *)) {
+    st->error_hook = f;
+}
+
+int error_hooked() {
+    return st->error_hook != 0;
+}
 
 void parse_error(const char *s) {
-    if (line.no != prev_error_line_no) {
-        printf("\n%4d: %s", line.no, line.buf);
-        prev_error_line_no = line.no;
+    if (st->error_hook) {
+	st->error_hook(s);
+	return;
+    }
+    FILE *fp = (st->err) ? st->err : stdout;
+    Line *p = at();
+    if (errors_over_limit()) return;
+    if (p->no != st->prev_error_line_no) {
+        fprintf(fp, "\n%4d: %s", p->no, p->buf);
+        st->prev_error_line_no = p->no;
     }
 //    printf("ERROR: %s before %s at col %d\n", s, nameof(tok.sym), line.pos );
-    printf("ERROR: %s at col %d\n", s, line.pos );
+    fprintf(fp, "ERROR: %s at col %d\n", s, p->pos );
+    if (++st->error_cnt == error_limit)
+	fprintf(fp, "ERROR: too many errors, the rest is not checked\n");
+}
+
+/* at most n diagnostics a unit, 0 for no limit; the same for every context */
+void set_error_limit(int n) {
+    error_limit = n;
+}
+
+int get_error_limit() {
+    return error_limit;
+}
+
+/* a new unit begins : a whole input, or a body read on its own */
+void reset_errors() {
+    st->error_cnt = 0;
+    st->prev_error_line_no = 0;
+}
+
+int errors_over_limit() {
+    return error_limit && st->error_cnt >= error_limit;
+}
+
+/* print the diagnostics to fp, or to stdout again with 0 */
+void set_error_output(FILE *fp) {
+    st->err = fp;
+    st->prev_error_line_no = 0;
 }
 
 #define SQ ('\'')
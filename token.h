@@ -1,9 +1,11 @@
 #ifndef _TOKEN_H_
 #define _TOKEN_H_
+#include <stdio.h>
 
 #define MAX_LEXEME 255
 #define MAX_LINE   1000
 #define MAX_STR_BUF 10000
+#define LOOKAHEAD  16	/* tokens peek() can read past the current one */
 
 enum tokentype {ID=256, ILIT, CLIT, FLIT, SLIT,
 ARIOP, RELOP, LOGOP, ASNOP, DUPOP, CMT, 
@@ -45,13 +47,21 @@ typedef struct Token {
     int  index;
     int  ival;	/* if sym==OP, optype is stored */
     char *sval;
+    int  no, pos;	/* where it begins */
+    int  prev_no;	/* line of the token before */
 } Token ;
 
-extern Token tok;
+/* the token source of one context, see context.h */
+typedef struct TOK_state TOK_state;
+TOK_state *new_TOK_state(void);
+void use_TOK(TOK_state *);
+TOK_state *cur_TOK(void);
+void free_TOK(TOK_state *);
+Token *cur_token(void);
 
 Token *gettoken(void);
-void skiptoken(int);
-void skiptoken2(int,int);
+Token *peek(int);
+int  skipto(const int *);
 
 typedef struct Line {
     int no;
@@ -60,12 +70,21 @@ typedef struct Line {
     char buf[MAX_LINE];
 } Line;
 
-extern Line line;
-
 char *insert_STR(char *);
-int   get_offset_STR(char *);
+int   get_STR_offset(char *);
+char *get_STR(int);
 
 void initline(void);
+void set_input(FILE *);
+void keep_input(int);
+void tell_input(int *, int *);
+void tell_scan(int *, int *);
+Token *ahead(int);
+void push_ahead(Token *);
+Token *pop_ahead(void);
+void seek_input(int, int);
+void share_input(TOK_state *);
+int  edit_input(int, int, char *);
 int nextch(void);
 int prevch(void);
 void clear_lexeme(void);
@@ -78,6 +97,13 @@ int getlineno(void);
 int getlinepos(void);
 
 void parse_error(const char *);
+void set_error_output(FILE *);
+void set_error_limit(int);
+int  get_error_limit(void);
+void reset_errors(void);
+int  errors_over_limit(void);
+void set_error_hook(void (*)(const char *));
+int  error_hooked(void);
 
 typedef struct kwentry {
     const char *text;
@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "type.h"
 #include "sym.h"
 #include "token.h"
@@ -14,6 +15,182 @@ son[0] : element type (used only ARRAY, POINTER)
 
 inline AST elem(AST a) { return get_son0(a); }
 
+/*
+   canonical types : every distinct type gets a small id.  primitive
+   types are told apart by name, arrays and pointers by their element
+   id (and length), while classes, structs and functions are a type of
+   their own per node.  compat is the id of the same type with char
+   read as int, so equality under the int/char rule is one compare.
+
+   each entry also keeps the size, alignment and (for arrays) element
+   stride in bytes, worked out once.  a struct has no size until
+   layout_record() sets it, and neither has an array of it.
+ */
+typedef struct typeentry {
+    int  kind;
+    char *name;	/* tPRIM, tVOID */
+    int  elem;	/* tARRAY, tPOINTER */
+    int  len;	/* tARRAY */
+    AST  node;	/* first node of the type; the key of nominal types */
+    int  compat;
+    bool laid;	/* size, align and stride are known */
+    int  size;
+    int  align;
+    int  stride;
+    int  rsize;	/* tSTRUCT, tCLASS : size of the record */
+} typeentry;
+
+/* the table of one context, see context.c */
+struct TYPE_state {
+    typeentry *typetab;
+    int type_cnt, type_max;
+    int *type_hash;
+    int type_hsize;
+    int *node_tid;	/* AST -> id, 0 if not known yet */
+    int node_tmax;
+};
+
+static TYPE_state main_state;
+static __thread TYPE_state *st = &main_state;
+
+TYPE_state *new_TYPE_state()       { return (TYPE_state *)calloc(1, sizeof(TYPE_state)); }
+void use_TYPE(TYPE_state *s) { st = (s) ? s : &main_state; }
+TYPE_state *cur_TYPE()       { return st; }
+
+void free_TYPE(TYPE_state *s) {
+    free(s->typetab);
+    free(s->type_hash);
+    free(s->node_tid);
+    if (s != &main_state) free(s);
+}
+
+static bool structural(int kind) { return kind == tARRAY || kind == tPOINTER; }
+static bool named(int kind)      { return kind == tPRIM || kind == tVOID; }
+
+static unsigned type_key(int kind, char *name, int e, int len, AST node) {
+    unsigned h = 2166136261u;
+    h = (h ^ kind) * 16777619u;
+    if (named(kind)) {
+	while (*name) h = (h ^ (unsigned char)*name++) * 16777619u;
+    } else if (structural(kind)) {
+	h = (h ^ e) * 16777619u;
+	h = (h ^ len) * 16777619u;
+    } else {
+	h = (h ^ node) * 16777619u;
+    }
+    return h ^ (h >> 15);
+}
+
+static bool same_type(typeentry *tp, int kind, char *name, int e, int len, AST node) {
+    if (tp->kind != kind) return false;
+    if (named(kind)) return strcmp(tp->name, name) == 0;
+    if (structural(kind)) return tp->elem == e && tp->len == len;
+    return tp->node == node;
+}
+
+static void rehash_type() {
+    int i, n = (st->type_hsize) ? st->type_hsize * 2 : 256;
+
+    free(st->type_hash);
+    st->type_hash = (int *)calloc(n, sizeof(int));
+    st->type_hsize = n;
+    for (i=1;i<=st->type_cnt;i++) {
+	typeentry *tp = &st->typetab[i];
+	unsigned h = type_key(tp->kind, tp->name, tp->elem, tp->len, tp->node);
+	while (st->type_hash[h & (n-1)]) h++;
+	st->type_hash[h & (n-1)] = i;
+    }
+}
+
+static void lay_type(int);
+
+static int intern_type(int kind, char *name, int e, int len, AST node) {
+    unsigned h = type_key(kind, name, e, len, node);
+    typeentry *tp;
+    int id;
+
+    if (st->type_hsize == 0) rehash_type();
+    for (;; h++) {
+	id = st->type_hash[h & (st->type_hsize-1)];
+	if (id == 0) break;
+	if (same_type(&st->typetab[id], kind, name, e, len, node)) return id;
+    }
+
+    if (st->type_cnt+1 >= st->type_max) {
+	st->type_max = (st->type_max) ? st->type_max * 2 : 256;
+	st->typetab = (typeentry *)realloc(st->typetab, st->type_max * sizeof(typeentry));
+    }
+    id = ++st->type_cnt;
+    tp = &st->typetab[id];
+    tp->kind = kind;
+    tp->name = name;
+    tp->elem = e;
+    tp->len = len;
+    tp->node = node;
+    tp->compat = id;
+    tp->laid = false;
+    tp->rsize = 0;
+    st->type_hash[h & (st->type_hsize-1)] = id;
+    if (st->type_cnt * 2 > st->type_hsize) rehash_type();
+
+    /* with char read as int */
+    if (named(kind) && strcmp(name, "char") == 0)
+	st->typetab[id].compat = intern_type(kind, "int", 0, 0, 0);
+    else if (structural(kind) && st->typetab[e].compat != e)
+	st->typetab[id].compat = intern_type(kind, 0, st->typetab[e].compat, len, 0);
+    lay_type(id);
+    return id;
+}
+
+/* the canonical id of type node a, 0 if a is not a type */
+int get_typeid(AST a) {
+    int kind, id;
+
+    if (a <= 0) return 0;
+    if (a < st->node_tmax && st->node_tid[a]) return st->node_tid[a];
+
+    kind = nodetype(a);
+    switch (kind) {
+	case tPRIM: case tVOID:
+	    id = intern_type(kind, get_text(a), 0, 0, 0);
+	    break;
+	case tARRAY: case tPOINTER:
+	    if ((id = get_typeid(elem(a))) == 0) return 0;
+	    id = intern_type(kind, 0, id, (kind == tARRAY) ? get_ival(a) : 0, 0);
+	    break;
+	case tCLASS: case tSTRUCT: case tFUNC:
+	    id = intern_type(kind, 0, 0, 0, a);
+	    break;
+	default:
+	    return 0;
+    }
+
+    if (a >= st->node_tmax) {
+	int n = (st->node_tmax) ? st->node_tmax : 1024;
+	while (n <= a) n *= 2;
+	st->node_tid = (int *)realloc(st->node_tid, n * sizeof(int));
+	bzero(st->node_tid + st->node_tmax, (n - st->node_tmax) * sizeof(int));
+	st->node_tmax = n;
+    }
+    return st->node_tid[a] = id;
+}
+
+/* the id under the int/char rule */
+int get_compatid(AST a) {
+    int id = get_typeid(a);
+    return (id) ? st->typetab[id].compat : 0;
+}
+
+/* intern every type node made so far; get_typeid() then only reads */
+void intern_types() {
+    int a, n = count_AST();
+    for (a=1;a<=n;a++) get_typeid(a);
+}
+
+static int prim_id(char *name) {
+    return intern_type(tPRIM, name, 0, 0, 0);
+}
+
 AST make_type(char *name) {
     AST a = make_AST_name(name);
     if (a<=4) return a;
@@ -25,6 +202,7 @@ AST pointer_type(char *name, AST e) {
     AST a = new_AST();
     set_node(a, tPOINTER, name, 0); 
     set_typeofnode(a, e);
+    get_typeid(a);
     return a;
 }
 
@@ -39,6 +217,7 @@ AST array_type(char *name, AST e, int sz) {
     AST a = new_AST();
     set_node(a, tARRAY, name, sz); 
     set_typeofnode(a, e);
+    get_typeid(a);
     return a;
 }
 
@@ -72,6 +251,8 @@ AST typeof_AST(AST t) {
     int idx;
     int ty=0;
 
+    if (ty = get_exprtype(t)) return ty;
+
     switch (nodetype(t)) {
 	case nNAME:
 	    idx = lookup_SYM_all(get_text(t));
@@ -86,8 +267,18 @@ AST typeof_AST(AST t) {
 	    ty = get_typeofnode(t);
 	    break;
 
-	case nOP2: case nOP0: case nOP1:  
+	case nOP2:
+	    ty = optype2(get_ival(t), 0, 0, t);
+	    set_exprtype(t, ty);
+	    break;
+
+	case nOP0: case nOP1:  
 	    ty = typeof_AST(get_typeofnode(t));
+	    set_exprtype(t, ty);
+	    break;
+
+	case nCONV:
+	    ty = get_typeofnode(t);
 	    break;
 
 	case nDEREF:
@@ -96,6 +287,7 @@ AST typeof_AST(AST t) {
 		parse_error("expected pointer type");
 	    }
 	    ty = get_typeofnode(ty);
+	    set_exprtype(t, ty);
 	    break;
 
 	case nLVAL:
@@ -108,6 +300,7 @@ AST typeof_AST(AST t) {
 		} else ty = get_son0(ty);
 		get_sons(exprs, 0, &exprs, 0, 0);
 	    }
+	    set_exprtype(t, ty);
 	    break;
 
     }
@@ -115,22 +308,12 @@ AST typeof_AST(AST t) {
 }
 
 static bool equal(AST x1, AST x2) {
-    char *text1, *text2;
+    int c1;
     switch (nodetype(x1)) {
-	case tINT: case tCHAR: case tFLOAT: case tSTRING:
 	case tPRIM: case tCLASS: case tSTRUCT:
-	    if (x1 == x2) return true;
-	    text1 = get_text(x1);
-	    text2 = get_text(x2);
-	    if ((strncmp(text1, "int")==0 || strncmp(text1, "char") == 0) && (strncmp(text2, "int")==0 || strncmp(text2, "char") == 0)) return true;
-	    break;
-	case tARRAY:
-	    if (nodetype(x2) != tARRAY) break;
-	    if (get_ival(x1) != get_ival(x2)) break;
-	    return equal( elem(x1), elem(x2));
-	case tPOINTER:
-	    if (nodetype(x2) != tPOINTER) break;
-	    return equal( elem(x1), elem(x2));
+	case tARRAY: case tPOINTER:
+	    c1 = get_compatid(x1);
+	    return c1 != 0 && c1 == get_compatid(x2);
 	default:
 	    break;
     }
@@ -145,18 +328,202 @@ bool equaltype(AST a1, AST a2) {
     return equal(x1,x2);
 }
 
-void checktypesingleop(AST a){
-    int x1 = typeof_AST(a);
-    char *text = get_text(x1);
-    switch(nodetype(x1)){
-	case tPRIM: 
-	    if (strncmp(text, "int") == 0 || strncmp(text, "char") == 0 ||strncmp(text, "float") == 0 ||strncmp(text, "pointer") == 0) return;
-	    break;
-	case tINT: case tCHAR: case tFLOAT: case tPOINTER: case tARRAY:
-	    return;
+/*
+   operator typing : each operand falls in a type class, and optab
+   gives for (operator group, left class, right class) the class of the
+   result and the class each operand is converted to.  SAME means the
+   operand types must be equal and the result has the left type.
+ */
+enum { TC_NONE, TC_CHAR, TC_INT, TC_FLOAT, TC_STRING, TC_PTR, TC_ARRAY, TC_RECORD, NTC };
+enum { OP_ARITH, OP_BIT, OP_REL, OP_LOG, NOPG };
+#define SAME (-1)
+
+typedef struct oprule {
+    signed char res;	/* TC_NONE : operands do not fit */
+    signed char lconv, rconv;
+} oprule;
+
+#define X   { TC_NONE, 0, 0 }
+#define S   { SAME, 0, 0 }
+#define C   { TC_CHAR, 0, 0 }
+#define I   { TC_INT, 0, 0 }
+#define F   { TC_FLOAT, 0, 0 }
+#define IL  { TC_INT, TC_INT, 0 }	/* char op int */
+#define IR  { TC_INT, 0, TC_INT }	/* int op char */
+
+static const oprule optab[NOPG][NTC][NTC] = {
+    /*             none char int float string ptr array record */
+    [OP_ARITH] = {
+	[TC_CHAR]   = { X, C, IL, X, X, X, X, X },
+	[TC_INT]    = { X, IR, I, X, X, X, X, X },
+	[TC_FLOAT]  = { X, X, X, F, X, X, X, X },
+	[TC_STRING] = { X, X, X, X, S, X, X, X },
+	[TC_PTR]    = { X, X, X, X, X, S, X, X },
+	[TC_ARRAY]  = { X, X, X, X, X, X, S, X },
+	[TC_RECORD] = { X, X, X, X, X, X, X, S },
+    },
+    [OP_BIT] = {
+	[TC_CHAR]   = { X, C, IL, X, X, X, X, X },
+	[TC_INT]    = { X, IR, I, X, X, X, X, X },
+    },
+    [OP_REL] = {
+	[TC_CHAR]   = { X, I, IL, X, X, X, X, X },
+	[TC_INT]    = { X, IR, I, X, X, X, X, X },
+	[TC_FLOAT]  = { X, X, X, I, X, X, X, X },
+	[TC_STRING] = { X, X, X, X, S, X, X, X },
+	[TC_PTR]    = { X, X, X, X, X, S, X, X },
+	[TC_ARRAY]  = { X, X, X, X, X, X, S, X },
+	[TC_RECORD] = { X, X, X, X, X, X, X, S },
+    },
+    [OP_LOG] = {
+	[TC_CHAR]   = { X, I, IL, X, X, X, X, X },
+	[TC_INT]    = { X, IR, I, X, X, X, X, X },
+	[TC_FLOAT]  = { X, X, X, I, X, X, X, X },
+    },
+};
+
+/*
+   unary operators : the class of the result for (operator group,
+   operand class).  + - ++ -- keep the operand type, ! gives int and
+   ~ takes integers only.
+ */
+enum { OP_SIGN, OP_NOT, OP_COMPL, OP_STEP, NOPG1 };
+
+static const signed char optab1[NOPG1][NTC] = {
+    /*            none char int float string ptr array record */
+    [OP_SIGN]  = { 0, SAME, SAME, SAME, 0, SAME, SAME, 0 },
+    [OP_NOT]   = { 0, TC_INT, TC_INT, TC_INT, 0, TC_INT, TC_INT, 0 },
+    [OP_COMPL] = { 0, SAME, SAME, 0, 0, 0, 0, 0 },
+    [OP_STEP]  = { 0, SAME, SAME, SAME, 0, SAME, SAME, 0 },
+};
+
+static const char *opmsg1[NOPG1] = {
+    "Expected type int, char, float or pointer",
+    "Expected type int, char, float or pointer",
+    "Expected type int or char",
+    "Expected type int, char, float or pointer",
+};
+
+#undef X
+#undef S
+#undef C
+#undef I
+#undef F
+#undef IL
+#undef IR
+
+static int type_class(AST ty) {
+    int id;
+    switch (nodetype(ty)) {
+	case tPRIM:
+	    id = get_typeid(ty);
+	    if (id == prim_id("char"))   return TC_CHAR;
+	    if (id == prim_id("int"))    return TC_INT;
+	    if (id == prim_id("float"))  return TC_FLOAT;
+	    if (id == prim_id("string")) return TC_STRING;
+	    return TC_NONE;
+	case tPOINTER:  return TC_PTR;
+	case tARRAY:    return TC_ARRAY;
+	case tCLASS:
+	case tSTRUCT:   return TC_RECORD;
+	default:        return TC_NONE;
+    }
+}
+
+static int op_group(int op) {
+    switch (op) {
+	case '<': case '>': case LTEQ: case GTEQ: case EQEQ: case NOTEQ:
+	    return OP_REL;
+	case ANDAND: case OROR: case XORXOR:
+	    return OP_LOG;
+	case '&': case '|': case '^': case LSHIFT: case RSHIFT:
+	    return OP_BIT;
+	default:
+	    return OP_ARITH;
+    }
+}
+
+static int op_group1(int op) {
+    switch (op) {
+	case '!':        return OP_NOT;
+	case '~':        return OP_COMPL;
+	case PLUSPLUS:
+	case MINUSMINUS: return OP_STEP;
+	default:         return OP_SIGN;
+    }
+}
+
+static AST class_type(int tc) {
+    switch (tc) {
+	case TC_CHAR:  return make_AST_name("char");
+	case TC_INT:   return make_AST_name("int");
+	case TC_FLOAT: return make_AST_name("float");
+	default:       return 0;
     }
-    printf("%s\n", text);
-    parse_error("Expected type int, char, float or pointer");
+}
+
+/* e wrapped in the conversion tc, if any */
+AST convert_type(AST e, int tc) {
+    return (tc) ? make_AST_conv(class_type(tc), e) : e;
+}
+
+/*
+   the result type of binary operator op.  with s0 and s1 the operands
+   are checked and wrapped in the conversions they need; with t the
+   type of the existing node t is worked out again.
+ */
+AST optype2(int op, AST *s0, AST *s1, AST t) {
+    AST l, r, ty;
+    int lc, rc;
+
+    if (t) {
+	get_sons(t, &l, &r, 0, 0);
+	return opcheck2(op, l, r, 0, 0);
+    }
+    ty = opcheck2(op, *s0, *s1, &lc, &rc);
+    *s0 = convert_type(*s0, lc);
+    *s1 = convert_type(*s1, rc);
+    return ty;
+}
+
+/*
+   the same without touching the tree : the conversions l and r need
+   are left in *lc and *rc for convert_type().  with lc 0 the operands
+   are not checked.
+ */
+AST opcheck2(int op, AST l, AST r, int *lc, int *rc) {
+    AST lt, rt;
+    const oprule *rp;
+
+    lt = typeof_AST(l);
+    rt = typeof_AST(r);
+    rp = &optab[op_group(op)][type_class(lt)][type_class(rt)];
+
+    if (lc) *lc = *rc = 0;
+    if (rp->res == TC_NONE || (rp->res == SAME && !equal(lt, rt))) {
+	if (lc) parse_error("Type mismatched between two arguments of operator");
+	return lt;
+    }
+    if (lc) {
+	*lc = rp->lconv;
+	*rc = rp->rconv;
+    }
+    if (rp->res == SAME) return lt;
+    if (rp->res == TC_CHAR) return lt;
+    return class_type(rp->res);
+}
+
+/* the result type of unary operator op on s */
+AST optype1(int op, AST s) {
+    AST ty = typeof_AST(s);
+    int g = op_group1(op);
+    int res = optab1[g][type_class(ty)];
+
+    if (res == SAME) return ty;
+    if (res != TC_NONE) return class_type(res);
+    if (!error_hooked()) printf("%s\n", get_text(ty));
+    parse_error(opmsg1[g]);
+    return ty;
 }
 
 bool checkArgs(AST argsdecl, AST args){
@@ -180,12 +547,96 @@ bool checkArgs(AST argsdecl, AST args){
     return mArgsdecl == 0 && mArgs == 0;
 }
 
-int get_sizeoftype(AST ty) {
-    switch (nodetype(ty)) {
-	case tFUNC: return 0;
-	case tARRAY: 
-		    return get_ival(ty) * get_sizeoftype(elem(ty));
-	default:
-		    return 1;
+/*
+   sizes and alignments in bytes.  a string is a pointer to its
+   characters and a class variable is a reference, so both take a
+   pointer.  a struct is held by value; its size and alignment are
+   set by layout_record() once its fields are known.
+ */
+#define PTR_SIZE 8
+
+static int prim_size(char *name) {
+    if (strcmp(name, "int") == 0)    return 4;
+    if (strcmp(name, "char") == 0)   return 1;
+    if (strcmp(name, "float") == 0)  return 4;
+    if (strcmp(name, "string") == 0) return PTR_SIZE;
+    return 0;	/* void */
+}
+
+/* work out size, align and stride of type id, if they can be known */
+static void lay_type(int id) {
+    typeentry *tp = &st->typetab[id];
+    typeentry *ep;
+
+    if (tp->laid) return;
+    switch (tp->kind) {
+	case tPRIM: case tVOID:
+	    tp->size = prim_size(tp->name);
+	    break;
+	case tPOINTER: case tCLASS:
+	    tp->size = PTR_SIZE;
+	    break;
+	case tFUNC:
+	    tp->size = 0;
+	    break;
+	case tARRAY:
+	    ep = &st->typetab[tp->elem];
+	    if (!ep->laid) lay_type(tp->elem);
+	    if (!ep->laid) return;
+	    tp->size = tp->len * ep->size;
+	    tp->align = ep->align;
+	    tp->stride = ep->size;
+	    tp->laid = true;
+	    return;
+	default:	/* tSTRUCT : see set_recordtype() */
+	    return;
     }
+    tp->align = (tp->size > 0) ? tp->size : 1;
+    tp->stride = tp->size;
+    tp->laid = true;
+}
+
+static typeentry *laid_type(AST ty) {
+    int id = get_typeid(ty);
+    if (id == 0) return 0;
+    lay_type(id);
+    return (st->typetab[id].laid) ? &st->typetab[id] : 0;
+}
+
+/* a class variable stays a reference, whatever the size of the class */
+void set_recordtype(AST ty, int size, int align) {
+    int id = get_typeid(ty);
+    typeentry *tp = &st->typetab[id];
+
+    if (id == 0) return;
+    tp->rsize = size;
+    if (tp->kind != tSTRUCT) return;
+    tp->size = size;
+    tp->align = (align > 0) ? align : 1;
+    tp->stride = size;
+    tp->laid = true;
+}
+
+int get_recordsize(AST ty) {
+    int id = get_typeid(ty);
+    return (id) ? st->typetab[id].rsize : 0;
+}
+
+int get_sizeoftype(AST ty) {
+    typeentry *tp;
+
+    if (get_typeid(ty) == 0) return 1;
+    tp = laid_type(ty);
+    return (tp) ? tp->size : 0;
+}
+
+int get_alignoftype(AST ty) {
+    typeentry *tp = laid_type(ty);
+    return (tp) ? tp->align : 1;
+}
+
+/* distance between elements of an array, the size of anything else */
+int get_strideoftype(AST ty) {
+    typeentry *tp = laid_type(ty);
+    return (tp) ? tp->stride : 0;
 }
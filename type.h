@@ -6,6 +6,13 @@ typedef enum {
     tPRIM, tARRAY, tPOINTER, tSTRUCT, tFUNC 
 } texp_type;
 
+/* the type table of one context, see context.h */
+typedef struct TYPE_state TYPE_state;
+TYPE_state *new_TYPE_state(void);
+void use_TYPE(TYPE_state *);
+TYPE_state *cur_TYPE(void);
+void free_TYPE(TYPE_state *);
+
 int make_type(char*);
 int pointer_type(char*, int);
 int array_type(char*, int, int);
@@ -14,8 +21,20 @@ int func_type(char *, int);
 int typeof_AST(int);
 void print_type(int);
 
+int  get_typeid(int);
+int  get_compatid(int);
 bool equaltype(int,int);
 bool checkArgs(int, int);
-void checktypesingleop(int);
+int  optype2(int, int*, int*, int);
+int  optype1(int, int);
+int  opcheck2(int, int, int, int*, int*);
+int  convert_type(int, int);
+void intern_types(void);
+
+int  get_sizeoftype(int);
+int  get_alignoftype(int);
+int  get_strideoftype(int);
+void set_recordtype(int, int, int);
+int  get_recordsize(int);
 
 #endif /* _TYPE_H_ */